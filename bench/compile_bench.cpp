@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#if defined(__GLIBC__)
+  #include <malloc.h>
+#endif
+
+#include "lsp_driver.hpp"
+#include "lsp_visitor.hpp"
+#include "module_cache.hpp"
+
+#include "etude_corpus.hpp"
+
+namespace fs = std::filesystem;
+
+// Heap in use, to see how peak memory of a compilation grows with
+//   the program. Sizes of freed blocks are known only to glibc, other
+//   platforms report nothing.
+namespace {
+
+std::atomic<size_t> heap_in_use = 0;
+std::atomic<size_t> heap_peak = 0;
+
+void CountAllocation(void* pointer) {
+#if defined(__GLIBC__)
+  if (pointer != nullptr) {
+    size_t size = malloc_usable_size(pointer);
+    size_t in_use = heap_in_use.fetch_add(size, std::memory_order_relaxed) + size;
+    size_t peak = heap_peak.load(std::memory_order_relaxed);
+    while (in_use > peak && !heap_peak.compare_exchange_weak(peak, in_use, std::memory_order_relaxed)) {
+    }
+  }
+#endif
+}
+
+void CountDeallocation(void* pointer) {
+#if defined(__GLIBC__)
+  if (pointer != nullptr) {
+    heap_in_use.fetch_sub(malloc_usable_size(pointer), std::memory_order_relaxed);
+  }
+#endif
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  void* pointer = std::malloc(std::max<size_t>(size, 1));
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  CountAllocation(pointer);
+  return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+  CountDeallocation(pointer);
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  operator delete(pointer);
+}
+
+namespace {
+
+// Shapes are scaled along one dimension at a time, the rest stay
+//   at the defaults of CorpusShape.
+struct Scaling {
+  const char* name;
+  std::vector<size_t> values;
+  size_t CorpusShape::*dimension;
+};
+
+const std::vector<Scaling> kScalings = {
+  {"modules", {1, 4, 16, 64}, &CorpusShape::modules},
+  {"import_depth", {1, 2, 4, 8}, &CorpusShape::import_depth},
+  {"functions_per_module", {4, 16, 64, 256}, &CorpusShape::functions_per_module},
+  {"statements_per_function", {8, 32, 128, 512}, &CorpusShape::statements_per_function},
+  // Field access looks members up linearly.
+  {"members_per_type", {4, 16, 64, 256}, &CorpusShape::members_per_type},
+  {"match_depth", {1, 2, 4, 8}, &CorpusShape::match_depth},
+};
+
+struct CompileStats {
+  size_t usages = 0;
+  // Of every module the driver has read, the standard library included.
+  size_t source_bytes = 0;
+};
+
+// What the server does on every compilation: parse, check, infer, visit.
+//   Throws what the compiler throws.
+CompileStats CompileCorpus(const std::string& main_module, const ModuleSearchPaths& search_paths, ModuleSourceCache* source_cache) {
+  // Compiler has global state, as in the server.
+  auto compiler_lock = LSPCompilationDriver::LockCompilerGlobals();
+
+  LSPCompilationDriver driver(main_module, search_paths, SourceOverlay(), source_cache);
+  driver.PrepareForTooling();
+
+  std::vector<lsDocumentSymbol> symbols;
+  std::vector<SymbolUsage> usages;
+  LSPVisitor visitor(&symbols, &usages, nullptr);
+  driver.RunVisitor(&visitor);
+
+  CompileStats stats{usages: usages.size()};
+  for (const OpenedModule& module: driver.OpenedModules()) {
+    if (!module.hash.has_value()) {
+      continue;
+    }
+    if (std::optional<ModuleSource> source = source_cache->Load(module.path)) {
+      stats.source_bytes += source->text->size();
+    }
+  }
+  return stats;
+}
+
+// Modules of the corpus, then the standard library, as the server has
+//   them, if ETUDE_STDLIB is set. Its size is what the memory budget
+//   has to be calibrated with, see kCompiledBytesPerSourceByte.
+ModuleSearchPaths SearchPathsFor(const fs::path& dir) {
+  ModuleSearchPaths search_paths{root: dir};
+  if (const char* stdlib = std::getenv("ETUDE_STDLIB"); stdlib != nullptr) {
+    search_paths.stdlib = stdlib;
+  }
+  return search_paths;
+}
+
+// Where in the corpus the compiler has stopped, if it says.
+std::string DescribeError(const std::exception& exc) {
+  if (const auto* err = dynamic_cast<const ErrorAtLocation*>(&exc); err != nullptr) {
+    const lex::Location& where = err->where();
+    // Lines are counted from zero, columns from one.
+    std::string file = where.unit != nullptr ? where.unit->GetAbsPath().string() : "";
+    return fmt::format("{}:{}:{}: {}", file, where.lineno + 1, where.columnno, err->what());
+  }
+  return exc.what();
+}
+
+void BM_Compile(benchmark::State& state, CorpusShape shape, fs::path dir) {
+  Corpus corpus = GenerateCorpus(shape);
+  WriteCorpus(corpus, dir);
+
+  ModuleSearchPaths search_paths = SearchPathsFor(dir);
+  ModuleSourceCache source_cache;
+
+  size_t peak_bytes = 0;
+  CompileStats stats;
+
+  for (auto _: state) {
+    size_t baseline = heap_in_use.load(std::memory_order_relaxed);
+    heap_peak.store(baseline, std::memory_order_relaxed);
+
+    try {
+      stats = CompileCorpus(corpus.MainModule(), search_paths, &source_cache);
+    } catch (const std::exception& exc) {
+      state.SkipWithError(fmt::format("corpus doesn't compile: {}", DescribeError(exc)).c_str());
+      break;
+    }
+
+    peak_bytes = std::max(peak_bytes, heap_peak.load(std::memory_order_relaxed) - baseline);
+  }
+
+  state.SetBytesProcessed(state.iterations() * corpus.Bytes());
+  state.counters["lines"] = static_cast<double>(corpus.Lines());
+  state.counters["usages"] = static_cast<double>(stats.usages);
+  state.counters["peak_heap_mb"] = static_cast<double>(peak_bytes) / (1 << 20);
+  state.counters["heap_per_source_byte"] = static_cast<double>(peak_bytes) / std::max<size_t>(stats.source_bytes, 1);
+}
+
+}  // namespace
+
+// Corpora are written to ETUDE_BENCH_CORPUS_DIR (or the temporary
+//   directory), a subdirectory per benchmark. Left there, to look at
+//   what was compiled.
+int main(int argc, char** argv) {
+  fs::path root = fs::temp_directory_path() / "etude-corpus";
+  if (const char* dir = std::getenv("ETUDE_BENCH_CORPUS_DIR"); dir != nullptr) {
+    root = dir;
+  }
+
+  // Written by the generator once and checked in (bench/corpus/small,
+  //   CorpusShape{modules: 2, import_depth: 2, functions_per_module: 2,
+  //   statements_per_function: 6, members_per_type: 2, match_depth: 2}).
+  //   If it stops compiling, the grammar has changed under the Emit*
+  //   functions of the generator.
+  {
+    ModuleSourceCache source_cache;
+    try {
+      CompileStats stats = CompileCorpus("main", SearchPathsFor(ETUDE_BENCH_CHECKED_CORPUS_DIR), &source_cache);
+      std::cerr << fmt::format("checked in corpus compiles: {} usages", stats.usages) << std::endl;
+    } catch (const std::exception& exc) {
+      std::cerr << fmt::format("checked in corpus doesn't compile: {}", DescribeError(exc)) << std::endl;
+      return 1;
+    }
+  }
+
+  // A generator, which writes something the parser doesn't take, would
+  //   make every benchmark skip. Better not to start at all then.
+  {
+    fs::path dir = root / "default";
+    Corpus corpus = GenerateCorpus(CorpusShape());
+    WriteCorpus(corpus, dir);
+
+    ModuleSourceCache source_cache;
+    try {
+      CompileStats stats = CompileCorpus(corpus.MainModule(), SearchPathsFor(dir), &source_cache);
+      std::cerr << fmt::format("default corpus compiles: {} lines, {} usages", corpus.Lines(), stats.usages) << std::endl;
+    } catch (const std::exception& exc) {
+      std::cerr << fmt::format("default corpus doesn't compile: {}", DescribeError(exc)) << std::endl;
+      return 1;
+    }
+  }
+
+  for (const Scaling& scaling: kScalings) {
+    for (size_t value: scaling.values) {
+      CorpusShape shape;
+      shape.*scaling.dimension = value;
+      // Every layer of imports needs modules of its own.
+      if (scaling.dimension == &CorpusShape::import_depth) {
+        shape.modules = std::max(shape.modules, 2 * value);
+      }
+
+      std::string name = fmt::format("BM_Compile/{}:{}", scaling.name, value);
+      benchmark::RegisterBenchmark(name.c_str(), BM_Compile, shape, root / fmt::format("{}_{}", scaling.name, value))
+        ->Unit(benchmark::kMillisecond);
+    }
+  }
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
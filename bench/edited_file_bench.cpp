@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "edited_file.hpp"
+#include "packed_position.hpp"
+
+#include "synthetic_file.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum Where : int64_t {
+  kStart,
+  kMiddle,
+  kEnd,
+};
+
+// Small edit is typing, large one is a paste or a big deletion.
+constexpr int64_t kSmallEdit = 1;
+constexpr int64_t kLargeEdit = 64 << 10;
+
+void FileSizes(benchmark::internal::Benchmark* benchmark) {
+  for (int64_t size: synthetic::kFileSizes) {
+    benchmark->Arg(size);
+  }
+}
+
+void Edits(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"size", "where", "edit"});
+  for (int64_t size: synthetic::kFileSizes) {
+    for (int64_t where: {kStart, kMiddle, kEnd}) {
+      for (int64_t edit: {kSmallEdit, kLargeEdit}) {
+        benchmark->Args({size, where, edit});
+      }
+    }
+  }
+}
+
+int LineAt(Where where, size_t line_count) {
+  switch (where) {
+    case kStart:  return 0;
+    case kMiddle: return static_cast<int>(line_count / 2);
+    // The last line of a synthetic file may be cut short.
+    case kEnd:    return static_cast<int>(line_count >= 2 ? line_count - 2 : 0);
+  }
+  return 0;
+}
+
+double Seconds(Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+void BM_SetContent(benchmark::State& state) {
+  std::string text = synthetic::Text(state.range(0));
+
+  for (auto _: state) {
+    EditedFile file;
+    // The copy is a part of it: the server gets the text by value too.
+    file.set_content(text);
+    benchmark::DoNotOptimize(file.size());
+  }
+
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SetContent)->Apply(FileSizes)->Unit(benchmark::kMicrosecond);
+
+// Only the insertion is timed. It's undone after, so that every
+//   iteration edits the same file.
+void BM_Insert(benchmark::State& state) {
+  EditedFile file;
+  file.set_content(synthetic::Text(state.range(0)));
+
+  int line = LineAt(static_cast<Where>(state.range(1)), file.line_count());
+  std::string inserted = state.range(2) == kSmallEdit ? std::string("a") : synthetic::Text(state.range(2));
+
+  lsPosition at{line, 4};
+  PositionShift shift(lsRange{at, at}, inserted);
+  lsRange undo{at, UnpackPosition(shift.NewEnd())};
+
+  for (auto _: state) {
+    auto start = Clock::now();
+    file.update_content(lsRange{at, at}, inserted);
+    state.SetIterationTime(Seconds(Clock::now() - start));
+
+    file.update_content(undo, "");
+  }
+}
+BENCHMARK(BM_Insert)->Apply(Edits)->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+// Only the deletion is timed, the text is put back after.
+void BM_Delete(benchmark::State& state) {
+  EditedFile file;
+  file.set_content(synthetic::Text(state.range(0)));
+
+  size_t line_count = file.line_count();
+  int line = LineAt(static_cast<Where>(state.range(1)), line_count);
+
+  lsRange deleted;
+  if (state.range(2) == kSmallEdit) {
+    deleted = lsRange{lsPosition{line, 4}, lsPosition{line, 5}};
+  } else {
+    // Whole lines, as many as fit after the line.
+    int lines = static_cast<int>(state.range(2) / synthetic::kLineLength);
+    line = std::max(0, std::min(line, static_cast<int>(line_count) - 1 - lines));
+    int end_line = std::min(line + lines, static_cast<int>(line_count) - 1);
+    deleted = lsRange{lsPosition{line, 0}, lsPosition{end_line, 0}};
+  }
+
+  size_t offset = file.offset_of(deleted.start);
+  std::string text = file.substr(offset, file.offset_of(deleted.end) - offset);
+
+  for (auto _: state) {
+    auto start = Clock::now();
+    file.update_content(deleted, "");
+    state.SetIterationTime(Seconds(Clock::now() - start));
+
+    file.update_content(lsRange{deleted.start, deleted.start}, text);
+  }
+}
+BENCHMARK(BM_Delete)->Apply(Edits)->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+// What used to be find_line_starts: the line index is a part of
+//   the rope, so it's a lookup now.
+void BM_LineStart(benchmark::State& state) {
+  EditedFile file;
+  file.set_content(synthetic::Text(state.range(0)));
+
+  std::minstd_rand rng(42);
+  std::uniform_int_distribution<size_t> lines(0, file.line_count() - 1);
+  std::vector<size_t> queries(1024);
+  std::generate(queries.begin(), queries.end(), [&] { return lines(rng); });
+
+  size_t i = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(file.line_start(queries[i]));
+    i = (i + 1) % queries.size();
+  }
+}
+BENCHMARK(BM_LineStart)->Apply(FileSizes);
+
+// Edits arrive as positions, each is converted to an offset.
+void BM_OffsetOf(benchmark::State& state) {
+  EditedFile file;
+  file.set_content(synthetic::Text(state.range(0)));
+
+  std::minstd_rand rng(42);
+  std::uniform_int_distribution<int> lines(0, static_cast<int>(file.line_count()) - 1);
+  std::uniform_int_distribution<int> columns(0, static_cast<int>(synthetic::kLineLength) - 1);
+  std::vector<lsPosition> queries(1024);
+  std::generate(queries.begin(), queries.end(), [&] { return lsPosition{lines(rng), columns(rng)}; });
+
+  size_t i = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(file.offset_of(queries[i]));
+    i = (i + 1) % queries.size();
+  }
+}
+BENCHMARK(BM_OffsetOf)->Apply(FileSizes);
+
+// A compilation after an edit flattens the rope once.
+void BM_ContentAfterEdit(benchmark::State& state) {
+  EditedFile file;
+  file.set_content(synthetic::Text(state.range(0)));
+
+  lsPosition at{static_cast<int>(file.line_count() / 2), 4};
+
+  for (auto _: state) {
+    file.update_content(lsRange{at, at}, "a");
+
+    auto start = Clock::now();
+    benchmark::DoNotOptimize(file.content().data());
+    state.SetIterationTime(Seconds(Clock::now() - start));
+
+    file.update_content(lsRange{at, lsPosition{at.line, at.character + 1}}, "");
+  }
+
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ContentAfterEdit)->Apply(FileSizes)->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+}  // namespace
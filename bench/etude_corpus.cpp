@@ -0,0 +1,245 @@
+#include "etude_corpus.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+
+#include <fmt/format.h>
+
+// Syntax of etude is written down only here, in the Emit* functions. The
+//   rest of the generator decides what goes where.
+namespace {
+
+std::string EmitImport(const std::string& module) {
+  return fmt::format("import {}\n", module);
+}
+
+std::string EmitStruct(const std::string& name, size_t members) {
+  std::string text = fmt::format("type {} = struct {{\n", name);
+  for (size_t i = 0; i < members; i += 1) {
+    text += fmt::format("  f{}: Int,\n", i);
+  }
+  text += "};\n\n";
+  return text;
+}
+
+std::string EmitSum(const std::string& name, size_t members) {
+  std::string text = fmt::format("type {} = sum {{\n", name);
+  for (size_t i = 0; i < members; i += 1) {
+    text += fmt::format("  v{}: Int,\n", i);
+  }
+  text += "};\n\n";
+  return text;
+}
+
+std::string EmitStructInit(size_t members, const std::vector<std::string>& values) {
+  std::string text = ".{ ";
+  for (size_t i = 0; i < members; i += 1) {
+    text += fmt::format("f{} = {}{}", i, values[i % values.size()], i + 1 < members ? ", " : " ");
+  }
+  text += "}";
+  return text;
+}
+
+std::string EmitVariant(size_t member, const std::string& value) {
+  return fmt::format(".v{}({})", member, value);
+}
+
+std::string EmitVar(const std::string& name, const std::string& type, const std::string& value) {
+  if (type.empty()) {
+    return fmt::format("  var {} = {};\n", name, value);
+  }
+  return fmt::format("  var {}: {} = {};\n", name, type, value);
+}
+
+std::string EmitIf(const std::string& condition, const std::string& then_value, const std::string& else_value) {
+  return fmt::format("if {} {{ {} }} else {{ {} }}", condition, then_value, else_value);
+}
+
+std::string EmitCall(const std::string& function, const std::string& lhs, const std::string& rhs) {
+  return fmt::format("{}({}, {})", function, lhs, rhs);
+}
+
+std::string EmitFieldAccess(const std::string& value, size_t member) {
+  return fmt::format("{}.f{}", value, member);
+}
+
+// Arms for every member, the first one holds the next level of nesting.
+std::string EmitMatch(const std::string& scrutinee, size_t members, size_t depth, const std::string& otherwise) {
+  std::string binding = fmt::format("p{}", depth);
+  std::string inner = depth > 1 ? EmitMatch(scrutinee, members, depth - 1, binding) : binding;
+
+  std::string text = fmt::format("match {} {{", scrutinee);
+  for (size_t i = 0; i < members; i += 1) {
+    text += fmt::format(" | .v{}({}) -> {}", i, binding, i == 0 ? inner : otherwise);
+  }
+  text += " }";
+  return text;
+}
+
+std::string EmitFunction(const std::string& name, const std::string& params, const std::string& body, const std::string& result) {
+  return fmt::format("fun {}{}{} = {{\n{}  {}\n}};\n\n", name, params.empty() ? "" : " ", params, body, result);
+}
+
+std::string EmitExport(const std::string& declarations) {
+  return fmt::format("export {{\n\n{}}}\n", declarations);
+}
+
+std::string ModuleName(size_t index) {
+  return fmt::format("m{}", index);
+}
+
+std::string FunctionName(size_t module, size_t function) {
+  return fmt::format("m{}_f{}", module, function);
+}
+
+// Layer of every module, the first layer is imported by the main module.
+size_t LayerOf(size_t module, const CorpusShape& shape) {
+  size_t layers = std::clamp<size_t>(shape.import_depth, 1, std::max<size_t>(shape.modules, 1));
+  return module * layers / std::max<size_t>(shape.modules, 1);
+}
+
+std::string GenerateFunction(
+  size_t module,
+  size_t function,
+  const std::vector<size_t>& imports,
+  const CorpusShape& shape,
+  std::minstd_rand& rng
+) {
+  std::string struct_type = fmt::format("S{}", module);
+  std::string sum_type = fmt::format("U{}", module);
+  size_t members = std::max<size_t>(shape.members_per_type, 1);
+
+  std::uniform_int_distribution<size_t> random_member(0, members - 1);
+  std::uniform_int_distribution<int> random_constant(1, 100);
+
+  std::string body;
+  body += EmitVar("s", struct_type, EmitStructInit(members, {"x", "y"}));
+  body += EmitVar("u", sum_type, EmitVariant(random_member(rng), "y"));
+
+  std::string previous = "x";
+  for (size_t i = 0; i < shape.statements_per_function; i += 1) {
+    std::string value;
+    switch (i % 5) {
+      case 0:
+        value = fmt::format("{} + x * {}", previous, random_constant(rng));
+        break;
+      case 1:
+        value = EmitIf(fmt::format("{} > {}", previous, random_constant(rng)), previous, "y");
+        break;
+      case 2:
+        value = fmt::format("{} + {}", EmitFieldAccess("s", random_member(rng)), previous);
+        break;
+      case 3:
+        // Earlier function of the module, or one of an imported module.
+        if (function > 0) {
+          std::uniform_int_distribution<size_t> callee(0, function - 1);
+          value = EmitCall(FunctionName(module, callee(rng)), previous, "y");
+        } else if (!imports.empty()) {
+          std::uniform_int_distribution<size_t> imported(0, imports.size() - 1);
+          std::uniform_int_distribution<size_t> callee(0, shape.functions_per_module - 1);
+          value = EmitCall(FunctionName(imports[imported(rng)], callee(rng)), previous, "y");
+        } else {
+          value = fmt::format("{} - y", previous);
+        }
+        break;
+      case 4:
+        value = shape.match_depth > 0 ? EmitMatch("u", members, shape.match_depth, previous) : previous;
+        break;
+    }
+
+    std::string name = fmt::format("a{}", i);
+    body += EmitVar(name, "", value);
+    previous = std::move(name);
+  }
+
+  return EmitFunction(FunctionName(module, function), "x y", body, previous);
+}
+
+}  // namespace
+
+size_t Corpus::Bytes() const {
+  size_t bytes = 0;
+  for (const CorpusModule& module: modules) {
+    bytes += module.text.size();
+  }
+  return bytes;
+}
+
+size_t Corpus::Lines() const {
+  size_t lines = 0;
+  for (const CorpusModule& module: modules) {
+    lines += std::count(module.text.begin(), module.text.end(), '\n');
+  }
+  return lines;
+}
+
+Corpus GenerateCorpus(const CorpusShape& shape) {
+  std::minstd_rand rng(shape.seed);
+  Corpus corpus;
+
+  auto modules_of_layer = [&](size_t layer) {
+    std::vector<size_t> modules;
+    for (size_t i = 0; i < shape.modules; i += 1) {
+      if (LayerOf(i, shape) == layer) {
+        modules.push_back(i);
+      }
+    }
+    return modules;
+  };
+
+  for (size_t module = 0; module < shape.modules; module += 1) {
+    std::vector<size_t> imports = modules_of_layer(LayerOf(module, shape) + 1);
+
+    std::string text;
+    for (size_t imported: imports) {
+      text += EmitImport(ModuleName(imported));
+    }
+    text += "\n";
+
+    std::string declarations;
+    declarations += EmitStruct(fmt::format("S{}", module), std::max<size_t>(shape.members_per_type, 1));
+    declarations += EmitSum(fmt::format("U{}", module), std::max<size_t>(shape.members_per_type, 1));
+    for (size_t function = 0; function < shape.functions_per_module; function += 1) {
+      declarations += GenerateFunction(module, function, imports, shape, rng);
+    }
+    text += EmitExport(declarations);
+
+    corpus.modules.push_back(CorpusModule{
+      name: ModuleName(module),
+      text: std::move(text),
+    });
+  }
+
+  // Calls the first function of every module it imports.
+  std::vector<size_t> imports = modules_of_layer(0);
+  std::string text;
+  for (size_t imported: imports) {
+    text += EmitImport(ModuleName(imported));
+  }
+  text += "\n";
+
+  std::string body;
+  std::string previous = "1";
+  for (size_t i = 0; i < imports.size() && shape.functions_per_module > 0; i += 1) {
+    std::string name = fmt::format("r{}", i);
+    body += EmitVar(name, "", EmitCall(FunctionName(imports[i], 0), previous, "2"));
+    previous = std::move(name);
+  }
+  text += EmitFunction("main", "", body, previous);
+
+  corpus.modules.push_back(CorpusModule{
+    name: "main",
+    text: std::move(text),
+  });
+
+  return corpus;
+}
+
+void WriteCorpus(const Corpus& corpus, const std::filesystem::path& dir) {
+  std::filesystem::create_directories(dir);
+  for (const CorpusModule& module: corpus.modules) {
+    std::ofstream file(dir / (module.name + ".et"), std::ios::binary | std::ios::trunc);
+    file << module.text;
+  }
+}
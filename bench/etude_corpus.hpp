@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Generates etude programs of a given shape, for the compile pipeline
+//   benchmarks. The same shape and seed give the same program.
+//
+// Modules are layered: the main module imports the first layer, every
+//   module of a layer imports the modules of the next one. Every function
+//   calls functions of its module and of the imported ones, reads fields
+//   of a struct and matches on a sum type, so that all the visitor
+//   paths are taken.
+struct CorpusShape {
+  // Besides the main one.
+  size_t modules = 4;
+  // Layers of imports, at most `modules`.
+  size_t import_depth = 2;
+
+  size_t functions_per_module = 16;
+  size_t statements_per_function = 8;
+
+  // A struct and a sum type per module, members are looked up linearly
+  //   by the compiler and by the visitor.
+  size_t members_per_type = 8;
+
+  // Match expressions nested in each other, per function.
+  size_t match_depth = 1;
+
+  uint32_t seed = 1;
+};
+
+struct CorpusModule {
+  std::string name;
+  std::string text;
+};
+
+struct Corpus {
+  // Last one is the main module.
+  std::vector<CorpusModule> modules;
+
+  const std::string& MainModule() const {
+    return modules.back().name;
+  }
+
+  size_t Bytes() const;
+  size_t Lines() const;
+};
+
+Corpus GenerateCorpus(const CorpusShape& shape);
+
+// Files are "<name>.et", as the driver looks for them.
+void WriteCorpus(const Corpus& corpus, const std::filesystem::path& dir);
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+// LibLsp.
+#include "LibLsp/lsp/lsRange.h"
+#include "LibLsp/lsp/textDocument/document_symbol.h"
+
+#include "lsp_visitor.hpp"
+
+// Files the benchmarks run on. Generated the same way every time, so
+//   results are comparable between commits.
+namespace synthetic {
+
+// Sizes of the files, in bytes: from a small module to something no one
+//   should ever open in an editor.
+inline constexpr std::initializer_list<int64_t> kFileSizes = {
+  1 << 10,
+  64 << 10,
+  1 << 20,
+  50 << 20,
+};
+
+// Every line is kLineLength bytes, including the line feed. Looks like
+//   etude code, though it's never compiled.
+inline constexpr size_t kLineLength = 40;
+
+inline std::string Text(size_t size) {
+  std::string text;
+  text.reserve(size + kLineLength);
+  for (size_t line = 0; text.size() < size; line += 1) {
+    std::string code = "    fun f" + std::to_string(line % 100000) + " x y = x + y;";
+    code.resize(kLineLength - 1, ' ');
+    text += code;
+    text += '\n';
+  }
+  text.resize(size);
+  return text;
+}
+
+inline size_t LineCount(size_t size) {
+  return (size + kLineLength - 1) / kLineLength;
+}
+
+// Usages in the lines of Text(size): the function name (its declaration)
+//   and x, y, x, y, which refer to the parameters of the same function.
+inline std::vector<SymbolUsage> Usages(size_t size) {
+  std::vector<SymbolUsage> usages;
+
+  size_t lines = size / kLineLength;
+  usages.reserve(lines * 5);
+
+  auto usage = [](int line, int column, int length, int decl_column) {
+    SymbolUsage result;
+    result.range = lsRange{lsPosition{line, column}, lsPosition{line, column + length}};
+    // Declarations are in no compilation unit, so they don't move with
+    //   edits. Usages do.
+    result.decl_def.decl_position.unit = nullptr;
+    result.decl_def.decl_position.lineno = line;
+    result.decl_def.decl_position.columnno = decl_column;
+    result.decl_def.def_position = result.decl_def.decl_position;
+    result.is_decl = column + length == decl_column;
+    result.is_def = result.is_decl;
+    return result;
+  };
+
+  for (size_t i = 0; i < lines; i += 1) {
+    int line = static_cast<int>(i);
+    int name_length = static_cast<int>(std::to_string(i % 100000).size()) + 1;
+
+    // "    fun f<n> x y = x + y;"
+    int name = 8;
+    int x = name + name_length + 1;
+    int y = x + 2;
+
+    usages.push_back(usage(line, name, name_length, name + name_length));
+    usages.push_back(usage(line, x, 1, x + 1));
+    usages.push_back(usage(line, y, 1, y + 1));
+    usages.push_back(usage(line, y + 4, 1, x + 1));
+    usages.push_back(usage(line, y + 8, 1, y + 1));
+  }
+
+  return usages;
+}
+
+// A function per line, with the parameters as children.
+inline std::vector<lsDocumentSymbol> Symbols(const std::vector<SymbolUsage>& usages) {
+  std::vector<lsDocumentSymbol> symbols;
+  for (size_t i = 0; i + 4 < usages.size(); i += 5) {
+    const lsRange& name = usages[i].range;
+
+    lsDocumentSymbol function;
+    function.name = "f" + std::to_string(name.start.line % 100000);
+    function.kind = lsSymbolKind::Function;
+    function.range = lsRange{lsPosition{name.start.line, 4}, lsPosition{name.start.line, static_cast<int>(kLineLength) - 1}};
+    function.selectionRange = name;
+    function.children.emplace();
+
+    for (size_t param = 1; param <= 2; param += 1) {
+      lsDocumentSymbol child;
+      child.name = param == 1 ? "x" : "y";
+      child.kind = lsSymbolKind::Variable;
+      child.range = usages[i + param].range;
+      child.selectionRange = usages[i + param].range;
+      function.children->push_back(std::move(child));
+    }
+
+    symbols.push_back(std::move(function));
+  }
+  return symbols;
+}
+
+}  // namespace synthetic
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "packed_position.hpp"
+#include "symbol_table.hpp"
+#include "usage_index.hpp"
+
+#include "synthetic_file.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Same path the declarations are not in, see synthetic::Usages.
+const std::string kFilePath = "/synthetic/main.et";
+
+void FileSizes(benchmark::internal::Benchmark* benchmark) {
+  for (int64_t size: synthetic::kFileSizes) {
+    benchmark->Arg(size);
+  }
+}
+
+std::vector<lsPosition> RandomPositions(size_t line_count) {
+  std::minstd_rand rng(42);
+  std::uniform_int_distribution<int> lines(0, static_cast<int>(line_count) - 1);
+  std::uniform_int_distribution<int> columns(0, static_cast<int>(synthetic::kLineLength) - 1);
+
+  std::vector<lsPosition> positions(1024);
+  std::generate(positions.begin(), positions.end(), [&] { return lsPosition{lines(rng), columns(rng)}; });
+  return positions;
+}
+
+// Done once per compilation.
+void BM_UsageIndexBuild(benchmark::State& state) {
+  std::vector<SymbolUsage> usages = synthetic::Usages(state.range(0));
+
+  for (auto _: state) {
+    UsageIndex index(usages, kFilePath);
+    benchmark::DoNotOptimize(index.size());
+  }
+
+  state.SetItemsProcessed(state.iterations() * usages.size());
+}
+BENCHMARK(BM_UsageIndexBuild)->Apply(FileSizes)->Unit(benchmark::kMicrosecond);
+
+// Cursor to usage, what hover and definition do.
+void BM_UsageIndexFind(benchmark::State& state) {
+  UsageIndex index(synthetic::Usages(state.range(0)), kFilePath);
+  std::vector<lsPosition> queries = RandomPositions(synthetic::LineCount(state.range(0)));
+
+  size_t i = 0;
+  for (auto _: state) {
+    benchmark::DoNotOptimize(index.Find(queries[i]));
+    i = (i + 1) % queries.size();
+  }
+}
+BENCHMARK(BM_UsageIndexFind)->Apply(FileSizes);
+
+// Cursor to all usages of the symbol, what highlight and rename do.
+void BM_UsageIndexOccurrences(benchmark::State& state) {
+  UsageIndex index(synthetic::Usages(state.range(0)), kFilePath);
+  std::vector<lsPosition> queries = RandomPositions(synthetic::LineCount(state.range(0)));
+
+  size_t i = 0;
+  for (auto _: state) {
+    std::optional<UsageIndex::UsageId> usage = index.Find(queries[i]);
+    if (usage.has_value()) {
+      benchmark::DoNotOptimize(index.OccurrencesOf(index.DeclarationOf(*usage)));
+    }
+    i = (i + 1) % queries.size();
+  }
+}
+BENCHMARK(BM_UsageIndexOccurrences)->Apply(FileSizes);
+
+// What replaced InvalidateAfterPosition: an edit moves usages and symbols
+//   after it (ViewedFile::ApplyEdit). Typing a line feed in the middle of
+//   the file is timed, removing it after is not.
+void BM_ApplyEdit(benchmark::State& state) {
+  std::vector<SymbolUsage> usages = synthetic::Usages(state.range(0));
+  UsageIndex index(usages, kFilePath);
+  SymbolTable symbols(synthetic::Symbols(usages));
+
+  int line = static_cast<int>(synthetic::LineCount(state.range(0)) / 2);
+  PositionShift insert(lsRange{lsPosition{line, 0}, lsPosition{line, 0}}, "\n");
+  PositionShift undo(lsRange{lsPosition{line, 0}, lsPosition{line + 1, 0}}, "");
+
+  for (auto _: state) {
+    auto start = Clock::now();
+    index.ApplyEdit(insert);
+    symbols.ApplyEdit(insert);
+    state.SetIterationTime(std::chrono::duration<double>(Clock::now() - start).count());
+
+    index.ApplyEdit(undo);
+    symbols.ApplyEdit(undo);
+  }
+}
+BENCHMARK(BM_ApplyEdit)->Apply(FileSizes)->UseManualTime()->Unit(benchmark::kMicrosecond);
+
+}  // namespace
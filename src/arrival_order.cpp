@@ -0,0 +1,326 @@
+#include "arrival_order.hpp"
+
+#include <algorithm>
+#include <array>
+
+#include <fmt/format.h>
+
+// LspCpp parses JSON with it, so it's there anyway.
+#include "rapidjson/document.h"
+
+#include "async_log.hpp"
+
+namespace {
+
+constexpr std::array<std::string_view, 3> kDocumentChanges = {
+  "textDocument/didOpen",
+  "textDocument/didChange",
+  "textDocument/didClose",
+};
+
+// Requests the server answers about a document.
+constexpr std::array<std::string_view, 6> kDocumentQueries = {
+  "textDocument/documentSymbol",
+  "textDocument/definition",
+  "textDocument/documentHighlight",
+  "textDocument/hover",
+  "textDocument/prepareRename",
+  "textDocument/rename",
+};
+
+bool OneOf(std::string_view method, const auto& methods) {
+  return std::find(methods.begin(), methods.end(), method) != methods.end();
+}
+
+std::string_view StringOf(const rapidjson::Value& value) {
+  return std::string_view(value.GetString(), value.GetStringLength());
+}
+
+std::string IdKey(const rapidjson::Value& id) {
+  if (id.IsString()) {
+    return fmt::format("\"{}\"", StringOf(id));
+  }
+  if (id.IsInt64()) {
+    return std::to_string(id.GetInt64());
+  }
+  return std::string();
+}
+
+}  // namespace
+
+ArrivalOrder::Query::~Query() {
+  if (order_ != nullptr) {
+    order_->Finished(key_);
+  }
+}
+
+ArrivalOrder::ArrivalOrder(std::streambuf* source)
+  : source_(source)
+  , writer_([this] { RunWriter(); }) {}
+
+ArrivalOrder::~ArrivalOrder() {
+  Stop();
+}
+
+void ArrivalOrder::Apply(
+  std::function<void()> change,
+  std::string_view method,
+  std::string_view uri,
+  std::optional<int64_t> version
+) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stopping_) {
+    return;
+  }
+
+  auto waiting_it = waiting_changes_.find(ChangeKey(method, uri, version));
+  if (waiting_it == waiting_changes_.end()) {
+    unnumbered_changes_.push_back(std::move(change));
+  } else {
+    ready_changes_.emplace(waiting_it->second.front(), std::move(change));
+    waiting_it->second.pop_front();
+    if (waiting_it->second.empty()) {
+      waiting_changes_.erase(waiting_it);
+    }
+  }
+
+  has_changes_.notify_one();
+}
+
+void ArrivalOrder::Stop() {
+  std::map<uint64_t, std::function<void()>> dropped;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    dropped = std::move(ready_changes_);
+    unnumbered_changes_.clear();
+  }
+  has_changes_.notify_all();
+  done_.notify_all();
+
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+}
+
+void ArrivalOrder::RunWriter() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  auto runnable = [&] {
+    return stopping_ || ready_changes_.contains(next_) || !unnumbered_changes_.empty();
+  };
+
+  while (true) {
+    if (!has_changes_.wait_for(lock, kTurnTimeout, runnable)) {
+      if (!ready_changes_.empty() && async_log::Enabled(LogLevel::kWarning)) {
+        async_log::Write(
+          LogLevel::kWarning,
+          fmt::format("change {} hasn't arrived yet, {} later ones are waiting for it", next_, ready_changes_.size())
+        );
+      }
+      continue;
+    }
+    if (stopping_) {
+      return;
+    }
+
+    std::function<void()> change;
+    bool numbered = false;
+    if (auto ready_it = ready_changes_.find(next_); ready_it != ready_changes_.end()) {
+      change = std::move(ready_it->second);
+      ready_changes_.erase(ready_it);
+      numbered = true;
+    } else {
+      change = std::move(unnumbered_changes_.front());
+      unnumbered_changes_.pop_front();
+    }
+
+    lock.unlock();
+    try {
+      change();
+    } catch (const std::exception& exc) {
+      // The next change still has to be applied.
+      if (async_log::Enabled(LogLevel::kError)) {
+        async_log::Write(LogLevel::kError, fmt::format("change failed: {}", exc.what()));
+      }
+    }
+    change = nullptr;
+    lock.lock();
+
+    if (numbered) {
+      next_ += 1;
+      done_.notify_all();
+    }
+  }
+}
+
+ArrivalOrder::Query ArrivalOrder::StartQuery(const lsRequestId& id) {
+  std::string key = RequestKey(id);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  auto query_it = pending_queries_.find(key);
+  if (query_it == pending_queries_.end()) {
+    return Query();
+  }
+
+  // Node stays, until the query is finished.
+  const PendingQuery& query = query_it->second;
+
+  auto ready = [&] {
+    return next_ >= query.barrier || query.state->token.IsCancelled() || stopping_;
+  };
+  if (!done_.wait_for(lock, kTurnTimeout, ready)) {
+    if (async_log::Enabled(LogLevel::kWarning)) {
+      async_log::Write(
+        LogLevel::kWarning,
+        fmt::format("request {}: changes before it aren't done, answering anyway", key)
+      );
+    }
+  }
+
+  return Query(this, std::move(key), query.state);
+}
+
+std::string ArrivalOrder::RequestKey(const lsRequestId& id) {
+  if (id.type == lsRequestId::kString) {
+    return fmt::format("\"{}\"", id.k_string);
+  }
+  return std::to_string(id.value);
+}
+
+std::string ArrivalOrder::ChangeKey(std::string_view method, std::string_view uri, std::optional<int64_t> version) {
+  return fmt::format("{} {} {}", method, uri, version.has_value() ? std::to_string(*version) : "");
+}
+
+ArrivalOrder::int_type ArrivalOrder::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+
+  // Blocks until the client sends something, then takes whatever else
+  //   has already arrived.
+  int_type first = source_->sbumpc();
+  if (traits_type::eq_int_type(first, traits_type::eof())) {
+    return traits_type::eof();
+  }
+  buffer_[0] = traits_type::to_char_type(first);
+
+  std::streamsize size = 1;
+  std::streamsize available = std::min<std::streamsize>(source_->in_avail(), sizeof(buffer_) - 1);
+  if (available > 0) {
+    size += source_->sgetn(buffer_ + 1, available);
+  }
+
+  // Numbered before the endpoint sees any of it.
+  framer_.Feed(std::string_view(buffer_, size), [&](std::string_view, std::string body) {
+    OnMessage(body);
+  });
+  setg(buffer_, buffer_, buffer_ + size);
+
+  return traits_type::to_int_type(buffer_[0]);
+}
+
+void ArrivalOrder::OnMessage(std::string_view body) {
+  rapidjson::Document json;
+  json.Parse(body.data(), body.size());
+  if (json.HasParseError() || !json.IsObject()) {
+    return;
+  }
+
+  auto method_it = json.FindMember("method");
+  if (method_it == json.MemberEnd() || !method_it->value.IsString()) {
+    // Response to a request of the server.
+    return;
+  }
+  std::string_view method = StringOf(method_it->value);
+
+  std::string_view uri;
+  std::optional<int64_t> version;
+  // Of the request to cancel.
+  std::string cancelled_id;
+
+  auto params_it = json.FindMember("params");
+  if (params_it != json.MemberEnd() && params_it->value.IsObject()) {
+    auto id_it = params_it->value.FindMember("id");
+    if (id_it != params_it->value.MemberEnd()) {
+      cancelled_id = IdKey(id_it->value);
+    }
+
+    auto document_it = params_it->value.FindMember("textDocument");
+    if (document_it != params_it->value.MemberEnd() && document_it->value.IsObject()) {
+      auto uri_it = document_it->value.FindMember("uri");
+      if (uri_it != document_it->value.MemberEnd() && uri_it->value.IsString()) {
+        uri = StringOf(uri_it->value);
+      }
+
+      auto version_it = document_it->value.FindMember("version");
+      if (version_it != document_it->value.MemberEnd() && version_it->value.IsInt64()) {
+        version = version_it->value.GetInt64();
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (method == "$/cancelRequest") {
+    if (auto query_it = pending_queries_.find(cancelled_id); query_it != pending_queries_.end()) {
+      Outdate(query_it->second, Outdating::kCancelRequest);
+    }
+    return;
+  }
+
+  if (method == "initialized") {
+    waiting_changes_[ChangeKey(method, {}, std::nullopt)].push_back(issued_);
+    issued_ += 1;
+    global_barrier_ = issued_;
+    return;
+  }
+
+  if (OneOf(method, kDocumentChanges) && !uri.empty()) {
+    // didClose has no version, the rest are told apart by it.
+    if (method == "textDocument/didClose") {
+      version.reset();
+    }
+    waiting_changes_[ChangeKey(method, uri, version)].push_back(issued_);
+    issued_ += 1;
+    document_barriers_[std::string(uri)] = issued_;
+
+    // Positions of the queries before are for the old text.
+    if (method != "textDocument/didOpen") {
+      for (auto& [key, query]: pending_queries_) {
+        if (query.uri == uri) {
+          Outdate(query, Outdating::kDocumentChange);
+        }
+      }
+    }
+    return;
+  }
+
+  auto id_it = json.FindMember("id");
+  if (OneOf(method, kDocumentQueries) && id_it != json.MemberEnd()) {
+    uint64_t barrier = global_barrier_;
+    if (auto document_it = document_barriers_.find(std::string(uri)); document_it != document_barriers_.end()) {
+      barrier = std::max(barrier, document_it->second);
+    }
+
+    pending_queries_[IdKey(id_it->value)] = PendingQuery{
+      uri: std::string(uri),
+      barrier: barrier,
+    };
+  }
+}
+
+void ArrivalOrder::Outdate(PendingQuery& query, Outdating reason) {
+  if (!query.state->token.IsCancelled()) {
+    query.state->outdating = reason;
+    query.state->token.Cancel();
+    // It may be waiting in StartQuery.
+    done_.notify_all();
+  }
+}
+
+void ArrivalOrder::Finished(const std::string& query_key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  pending_queries_.erase(query_key);
+}
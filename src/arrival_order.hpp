@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+// LibLsp.
+#include "LibLsp/JsonRpc/RequestInMessage.h"
+
+#include "cancellation.hpp"
+#include "session_recording.hpp"
+
+// Handlers run on several threads of the endpoint and start in no
+//   particular order. Changes of open files must still be applied in
+//   the order the client sent them, and a query must see the changes
+//   of its document sent before it.
+//
+// Passes through what the client sends and numbers the changes
+//   (didOpen, didChange, didClose, initialized) as they are read, before
+//   the endpoint dispatches them. A change handler hands the change over
+//   (see Apply) and returns; changes are applied one at a time by
+//   the writer thread, in the order they were numbered. A query waits
+//   until the changes of its document that came before it are done, and
+//   doesn't wait for anything else.
+//
+// Queries are also where $/cancelRequest is seen first. A query, which
+//   the client has cancelled, or whose document has changed since it was
+//   sent (the position is for the old text), is outdated: its handler
+//   stops waiting and answers with an error right away (RequestCancelled
+//   or ContentModified, see Outdating), instead of computing something
+//   nobody will look at.
+//
+// A change is never skipped: an incremental edit applied out of order
+//   corrupts the text. If the next one is late, the writer logs it every
+//   kTurnTimeout and keeps waiting. Changes, which weren't numbered (no
+//   such change was read), are applied by the writer in between. Queries
+//   don't wait for longer than kTurnTimeout, a late one is answered with
+//   what there is.
+class ArrivalOrder final : public std::streambuf {
+public:
+  static constexpr std::chrono::seconds kTurnTimeout{5};
+
+  explicit ArrivalOrder(std::streambuf* source);
+  ~ArrivalOrder();
+
+  ArrivalOrder(const ArrivalOrder&) = delete;
+  ArrivalOrder& operator=(const ArrivalOrder&) = delete;
+
+  // Runs the change on the writer thread in its turn. Version is there
+  //   for didOpen and didChange: a document may have several changes in
+  //   flight.
+  void Apply(
+    std::function<void()> change,
+    std::string_view method,
+    std::string_view uri = {},
+    std::optional<int64_t> version = std::nullopt
+  );
+
+  // Changes not applied yet are dropped, those handed over later too.
+  //   Call it before anything the changes refer to goes away.
+  void Stop();
+
+  // Why a query is outdated. The client is told apart: a cancelled
+  //   request is answered with RequestCancelled, one for an old text
+  //   with ContentModified.
+  enum class Outdating : uint8_t {
+    kNone,
+    kCancelRequest,
+    kDocumentChange,
+  };
+
+  struct QueryState {
+    CancellationToken token;
+    // Set before the token is cancelled.
+    std::atomic<Outdating> outdating = Outdating::kNone;
+  };
+
+  // Held by a query handler until it returns.
+  class Query {
+  public:
+    Query()
+      : state_(std::make_shared<QueryState>()) {}
+
+    Query(ArrivalOrder* order, std::string key, std::shared_ptr<QueryState> state)
+      : order_(order), key_(std::move(key)), state_(std::move(state)) {}
+
+    Query(Query&& other) noexcept
+      : order_(std::exchange(other.order_, nullptr)), key_(std::move(other.key_)), state_(std::move(other.state_)) {}
+
+    Query(const Query&) = delete;
+    Query& operator=(const Query&) = delete;
+    Query& operator=(Query&&) = delete;
+
+    ~Query();
+
+    bool Outdated() const {
+      return state_->token.IsCancelled();
+    }
+
+    // kNone, while the query isn't outdated.
+    Outdating Reason() const {
+      return Outdated() ? state_->outdating.load() : Outdating::kNone;
+    }
+
+    // Cancelled, once the query is outdated. For compilations the query
+    //   has to wait for.
+    const CancellationToken* Token() const {
+      return &state_->token;
+    }
+
+  private:
+    ArrivalOrder* order_ = nullptr;
+    std::string key_;
+    std::shared_ptr<QueryState> state_;
+  };
+
+  // Waits until the changes of the document sent before the request are
+  //   done, or until the request is outdated.
+  Query StartQuery(const lsRequestId& id);
+
+  // Request ids are numbers or strings, "1" and 1 are different ids.
+  static std::string RequestKey(const lsRequestId& id);
+
+protected:
+  int_type underflow() override;
+
+private:
+  static std::string ChangeKey(std::string_view method, std::string_view uri, std::optional<int64_t> version);
+
+  struct PendingQuery {
+    std::string uri;
+    // Changes of the document, which come before the query.
+    uint64_t barrier = 0;
+    std::shared_ptr<QueryState> state = std::make_shared<QueryState>();
+  };
+
+  void OnMessage(std::string_view body);
+  void RunWriter();
+  void Finished(const std::string& query_key);
+
+  // Must be called with mutex_ held.
+  void Outdate(PendingQuery& query, Outdating reason);
+
+  std::streambuf* source_;
+  MessageFramer framer_;
+  char buffer_[4096];
+
+  std::mutex mutex_;
+  std::condition_variable done_;
+
+  // Changes numbered so far. Every change before next_ is done,
+  //   the change with ticket next_ is the writer's next one.
+  uint64_t issued_ = 0;
+  uint64_t next_ = 0;
+
+  // Tickets of changes, which haven't been handed over yet.
+  std::unordered_map<std::string, std::deque<uint64_t>> waiting_changes_;
+
+  // Handed over, waiting for their turn. By ticket.
+  std::map<uint64_t, std::function<void()>> ready_changes_;
+  std::deque<std::function<void()>> unnumbered_changes_;
+  std::condition_variable has_changes_;
+  bool stopping_ = false;
+
+  // Ticket after the last change of every document, and after the last
+  //   change of everything (initialized).
+  std::unordered_map<std::string, uint64_t> document_barriers_;
+  uint64_t global_barrier_ = 0;
+
+  // Queries read, whose handlers haven't returned yet, by request key.
+  std::unordered_map<std::string, PendingQuery> pending_queries_;
+
+  // Last, started when everything else is there.
+  std::thread writer_;
+};
@@ -0,0 +1,282 @@
+#include "async_log.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace async_log {
+
+namespace {
+
+// Bounded multi-producer queue by Dmitry Vyukov, with a single consumer.
+//   Each cell has a sequence number, telling whether it is free for the
+//   producer with this position or filled for the consumer. Producers
+//   only contend on the enqueue position.
+//   https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+class MessageQueue {
+public:
+  explicit MessageQueue(size_t capacity)
+    : mask_(capacity - 1)
+    , cells_(std::make_unique<Cell[]>(capacity)) {
+      assert((capacity & mask_) == 0 && "capacity must be a power of two");
+      for (size_t i = 0; i < capacity; i += 1) {
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+      }
+  }
+
+  bool TryPush(LogLevel level, std::string&& message) {
+    Cell* cell = nullptr;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // The consumer hasn't freed the cell from the previous round.
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->level = level;
+    cell->message = std::move(message);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only from the consumer thread.
+  bool TryPop(LogLevel* level, std::string* message) {
+    Cell* cell = &cells_[dequeue_pos_ & mask_];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(dequeue_pos_ + 1) < 0) {
+      return false;
+    }
+
+    *level = cell->level;
+    *message = std::move(cell->message);
+    cell->sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+    dequeue_pos_ += 1;
+    return true;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    LogLevel level;
+    std::string message;
+  };
+
+  const size_t mask_;
+  const std::unique_ptr<Cell[]> cells_;
+
+  alignas(64) std::atomic<size_t> enqueue_pos_ = 0;
+  alignas(64) size_t dequeue_pos_ = 0;
+};
+
+std::string_view LevelName(LogLevel level) {
+  switch (level) {
+    case LogLevel::kTrace:   return "trace";
+    case LogLevel::kDebug:   return "debug";
+    case LogLevel::kInfo:    return "info";
+    case LogLevel::kWarning: return "warning";
+    case LogLevel::kError:   return "error";
+    case LogLevel::kOff:     return "off";
+  }
+  return "?";
+}
+
+void Append(std::string* out, LogLevel level, std::string_view message) {
+  out->push_back('[');
+  out->append(LevelName(level));
+  out->append("] ");
+  out->append(message);
+  out->push_back('\n');
+}
+
+class Backend {
+public:
+  Backend()
+    : queue_(kCapacity)
+    , writer_([this] { Run(); }) {}
+
+  ~Backend() {
+    Stop();
+  }
+
+  void Write(LogLevel level, std::string message) {
+    if (stopped_.load(std::memory_order_acquire)) {
+      std::string line;
+      Append(&line, level, message);
+      std::fwrite(line.data(), 1, line.size(), stderr);
+      std::fflush(stderr);
+      return;
+    }
+
+    if (!queue_.TryPush(level, std::move(message))) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    wakeups_.fetch_add(1, std::memory_order_release);
+    wakeups_.notify_one();
+  }
+
+  void Stop() {
+    std::lock_guard<std::mutex> lock(stop_mutex_);
+    if (!writer_.joinable()) {
+      return;
+    }
+
+    stopping_.store(true, std::memory_order_release);
+    wakeups_.fetch_add(1, std::memory_order_release);
+    wakeups_.notify_one();
+    writer_.join();
+
+    stopped_.store(true, std::memory_order_release);
+
+    // Pushed while the writer was finishing. The writer is gone, this
+    //   thread is the consumer now.
+    std::string rest;
+    LogLevel level;
+    std::string message;
+    while (queue_.TryPop(&level, &message)) {
+      Append(&rest, level, message);
+    }
+    std::fwrite(rest.data(), 1, rest.size(), stderr);
+    std::fflush(stderr);
+  }
+
+private:
+  static constexpr size_t kCapacity = 4096;
+
+  void Run() {
+    std::string batch;
+    LogLevel level;
+    std::string message;
+
+    while (true) {
+      // Taken before draining: a message pushed after the queue looked
+      //   empty changes the counter, and wait returns right away.
+      uint32_t seen = wakeups_.load(std::memory_order_acquire);
+      bool stopping = stopping_.load(std::memory_order_acquire);
+
+      while (queue_.TryPop(&level, &message)) {
+        Append(&batch, level, message);
+      }
+
+      if (size_t dropped = dropped_.exchange(0, std::memory_order_relaxed); dropped != 0) {
+        Append(&batch, LogLevel::kWarning, fmt::format("{} log messages dropped, queue is full", dropped));
+      }
+
+      // One write per batch, not per message.
+      if (!batch.empty()) {
+        std::fwrite(batch.data(), 1, batch.size(), stderr);
+        std::fflush(stderr);
+        batch.clear();
+      }
+
+      if (stopping) {
+        return;
+      }
+
+      wakeups_.wait(seen, std::memory_order_acquire);
+    }
+  }
+
+  MessageQueue queue_;
+  std::atomic<size_t> dropped_ = 0;
+
+  std::atomic<uint32_t> wakeups_ = 0;
+  std::atomic<bool> stopping_ = false;
+  std::atomic<bool> stopped_ = false;
+  std::mutex stop_mutex_;
+
+  // Last member, is started after everything else is initialized.
+  std::thread writer_;
+};
+
+Backend& Instance() {
+  static Backend backend;
+  return backend;
+}
+
+}  // namespace
+
+void Configure(std::string_view level, std::string_view traces) {
+  static constexpr std::pair<std::string_view, LogLevel> kLevels[] = {
+    {"trace", LogLevel::kTrace},
+    {"debug", LogLevel::kDebug},
+    {"info", LogLevel::kInfo},
+    {"warning", LogLevel::kWarning},
+    {"error", LogLevel::kError},
+    {"off", LogLevel::kOff},
+  };
+
+  static constexpr std::pair<std::string_view, TraceCategory> kCategories[] = {
+    {"content_holder", TraceCategory::kContentHolder},
+    {"invalidation", TraceCategory::kInvalidation},
+    {"visitor", TraceCategory::kVisitor},
+  };
+
+  if (!level.empty()) {
+    bool known = false;
+    for (const auto& [name, value]: kLevels) {
+      if (name == level) {
+        detail::level.store(value, std::memory_order_relaxed);
+        known = true;
+      }
+    }
+
+    if (!known && Enabled(LogLevel::kWarning)) {
+      Write(LogLevel::kWarning, fmt::format("unknown log level \"{}\", ignored", level));
+    }
+  }
+
+  uint32_t categories = 0;
+  while (!traces.empty()) {
+    size_t comma = traces.find(',');
+    std::string_view name = traces.substr(0, comma);
+    traces = comma == std::string_view::npos ? std::string_view() : traces.substr(comma + 1);
+
+    if (name.empty()) {
+      continue;
+    }
+
+    if (name == "all") {
+      categories = UINT32_MAX;
+      continue;
+    }
+
+    bool known = false;
+    for (const auto& [category_name, category]: kCategories) {
+      if (category_name == name) {
+        categories |= uint32_t{1} << static_cast<uint32_t>(category);
+        known = true;
+      }
+    }
+
+    if (!known && Enabled(LogLevel::kWarning)) {
+      Write(LogLevel::kWarning, fmt::format("unknown trace category \"{}\", ignored", name));
+    }
+  }
+  detail::trace_categories.store(categories, std::memory_order_relaxed);
+}
+
+void Write(LogLevel level, std::string message) {
+  Instance().Write(level, std::move(message));
+}
+
+void Shutdown() {
+  Instance().Stop();
+}
+
+}  // namespace async_log
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include <fmt/format.h>
+
+enum class LogLevel : uint8_t {
+  kTrace,
+  kDebug,
+  kInfo,
+  kWarning,
+  kError,
+  kOff,
+};
+
+// Traces are debug output of a particular part of the server. Each is
+//   switched on separately, they are too verbose to have all at once.
+enum class TraceCategory : uint8_t {
+  kContentHolder,
+  kInvalidation,
+  kVisitor,
+};
+
+// Messages are put into a bounded lock-free queue and written to stderr
+//   by a background thread. Writing to stderr may block (the editor reads
+//   it whenever it wants), the thread handling requests must not. If
+//   the queue is full, messages are dropped and the number of dropped
+//   ones is reported later.
+namespace async_log {
+
+namespace detail {
+
+inline std::atomic<LogLevel> level = LogLevel::kInfo;
+inline std::atomic<uint32_t> trace_categories = 0;
+
+}  // namespace detail
+
+inline bool Enabled(LogLevel level) {
+  return level >= detail::level.load(std::memory_order_relaxed);
+}
+
+inline bool TraceEnabled(TraceCategory category) {
+  return (detail::trace_categories.load(std::memory_order_relaxed) >> static_cast<uint32_t>(category)) & 1;
+}
+
+// Level is one of "trace", "debug", "info", "warning", "error", "off".
+//   Traces are a list of categories separated by commas:
+//   "content_holder", "invalidation", "visitor" or "all". Unknown names
+//   are reported and ignored.
+void Configure(std::string_view level, std::string_view traces);
+
+// Doesn't check the level, callers do it before formatting.
+void Write(LogLevel level, std::string message);
+
+// Writes out everything queued and stops the background thread. Later
+//   messages are written directly.
+void Shutdown();
+
+}  // namespace async_log
+
+// Arguments are not evaluated, if the category is off.
+#define ETUDE_TRACE(category, ...)                                              \
+  do {                                                                          \
+    if (async_log::TraceEnabled(TraceCategory::category)) {                     \
+      async_log::Write(LogLevel::kTrace, fmt::format(__VA_ARGS__));             \
+    }                                                                           \
+  } while (false)
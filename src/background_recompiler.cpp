@@ -0,0 +1,112 @@
+#include "background_recompiler.hpp"
+
+BackgroundRecompiler::BackgroundRecompiler(size_t num_workers, CompileFn compile)
+  : compile_(std::move(compile))
+  , pool_(num_workers) {}
+
+BackgroundRecompiler::~BackgroundRecompiler() {
+  CancelAll();
+}
+
+void BackgroundRecompiler::Start(std::vector<FileWithDependencies> files) {
+  auto pass = std::make_shared<Pass>();
+
+  std::unordered_set<std::string> in_pass;
+  for (const auto& [path, _]: files) {
+    in_pass.insert(path);
+  }
+
+  std::vector<std::string> ready;
+  for (const auto& [path, dependencies]: files) {
+    size_t unfinished = 0;
+    for (const std::string& dependency: dependencies) {
+      if (dependency != path && in_pass.contains(dependency)) {
+        pass->dependents[dependency].push_back(path);
+        unfinished += 1;
+      }
+    }
+
+    pass->unfinished_dependencies[path] = unfinished;
+    if (unfinished == 0) {
+      ready.push_back(path);
+    } else {
+      pass->waiting.insert(path);
+    }
+  }
+
+  // All of them are in cycles.
+  if (ready.empty() && !pass->waiting.empty()) {
+    ready.push_back(TakeLeastBlocked(*pass));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (current_pass_ != nullptr) {
+      current_pass_->token.Cancel();
+    }
+    current_pass_ = pass;
+  }
+
+  for (std::string& path: ready) {
+    Submit(pass, std::move(path));
+  }
+}
+
+void BackgroundRecompiler::CancelAll() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (current_pass_ != nullptr) {
+    current_pass_->token.Cancel();
+    current_pass_.reset();
+  }
+}
+
+void BackgroundRecompiler::Submit(std::shared_ptr<Pass> pass, std::string path) {
+  {
+    std::lock_guard<std::mutex> lock(pass->mutex);
+    pass->in_flight += 1;
+  }
+
+  pool_.Submit([this, pass = std::move(pass), path = std::move(path)] {
+    bool compiled = !pass->token.IsCancelled() && compile_(path, pass->token);
+    if (!compiled && !pass->token.IsCancelled()) {
+      Submit(pass, path);
+    }
+
+    std::vector<std::string> ready;
+    {
+      std::lock_guard<std::mutex> lock(pass->mutex);
+      pass->in_flight -= 1;
+
+      if (compiled) {
+        for (const std::string& dependent: pass->dependents[path]) {
+          // Could have been taken out of a cycle already.
+          if (--pass->unfinished_dependencies[dependent] == 0 && pass->waiting.erase(dependent) > 0) {
+            ready.push_back(dependent);
+          }
+        }
+      }
+
+      // Whatever is still waiting, waits for a cycle.
+      if (ready.empty() && pass->in_flight == 0 && !pass->waiting.empty() && !pass->token.IsCancelled()) {
+        ready.push_back(TakeLeastBlocked(*pass));
+      }
+    }
+
+    for (std::string& dependent: ready) {
+      Submit(pass, std::move(dependent));
+    }
+  });
+}
+
+std::string BackgroundRecompiler::TakeLeastBlocked(Pass& pass) {
+  auto least = pass.waiting.begin();
+  for (auto it = pass.waiting.begin(); it != pass.waiting.end(); ++it) {
+    if (pass.unfinished_dependencies[*it] < pass.unfinished_dependencies[*least]) {
+      least = it;
+    }
+  }
+
+  std::string path = *least;
+  pass.waiting.erase(least);
+  return path;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "cancellation.hpp"
+#include "thread_pool.hpp"
+
+// Recompiles open files, which became stale because a module they import
+//   changed, before anybody asks for them. Files are compiled dependencies
+//   first: a file starts once everything it imports from the same pass is
+//   done. Files of an import cycle can't wait for each other: once nothing
+//   else is ready, the one least waiting goes first.
+//
+// One worker is enough as of now: drivers share the compiler globals and
+//   take turns for them (see LockCompilerGlobals), more workers would
+//   only wait.
+//
+// A new pass cancels the previous one, its results would be outdated.
+//
+// Compilations are background ones (see CompilePriority): one that gave
+//   the compiler up midway is queued again, after the files queued
+//   meanwhile.
+class BackgroundRecompiler {
+public:
+  // Returns false, if the file wasn't compiled and should be tried again.
+  using CompileFn = std::function<bool(const std::string& path, const CancellationToken& token)>;
+
+  // File with all its dependencies (transitive, as DependencyGraph has
+  //   them). Dependencies outside of the pass are ignored.
+  using FileWithDependencies = std::pair<std::string, std::vector<std::string>>;
+
+  BackgroundRecompiler(size_t num_workers, CompileFn compile);
+
+  // A running compilation is cancelled, not waited for.
+  ~BackgroundRecompiler();
+
+  void Start(std::vector<FileWithDependencies> files);
+
+  void CancelAll();
+
+private:
+  struct Pass {
+    CancellationToken token;
+
+    std::mutex mutex;
+    std::unordered_map<std::string, size_t> unfinished_dependencies;
+    std::unordered_map<std::string, std::vector<std::string>> dependents;
+    // Not submitted yet.
+    std::unordered_set<std::string> waiting;
+    // Submitted, not done yet.
+    size_t in_flight = 0;
+  };
+
+  void Submit(std::shared_ptr<Pass> pass, std::string path);
+
+  // Must be called with pass.mutex held. Breaks an import cycle: the
+  //   waiting file with the fewest unfinished dependencies.
+  static std::string TakeLeastBlocked(Pass& pass);
+
+  const CompileFn compile_;
+
+  std::mutex mutex_;
+  std::shared_ptr<Pass> current_pass_;
+
+  // Last member, threads are joined before everything else is destroyed.
+  ThreadPool pool_;
+};
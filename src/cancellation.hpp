@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+
+// Thrown out of a compilation, when it is not needed anymore. Compilation
+//   results are not published then, previous ones are kept.
+class CompilationCancelled : public std::exception {
+public:
+  const char* what() const noexcept override {
+    return "compilation cancelled";
+  }
+};
+
+// Cancellation is cooperative: the one running the compilation checks
+//   the token at points, where it's safe to stop (between modules and
+//   between top-level declarations). Another thread cancels.
+class CancellationToken {
+public:
+  CancellationToken() = default;
+
+  // Cancelled also when the parent is. Parent must outlive the token.
+  explicit CancellationToken(const CancellationToken* parent)
+    : parent_(parent) {}
+
+  void Cancel() {
+    cancelled_.store(true, std::memory_order_relaxed);
+  }
+
+  bool IsCancelled() const {
+    return cancelled_.load(std::memory_order_relaxed) || (parent_ != nullptr && parent_->IsCancelled());
+  }
+
+  void ThrowIfCancelled() const {
+    if (IsCancelled()) {
+      throw CompilationCancelled();
+    }
+  }
+
+private:
+  std::atomic<bool> cancelled_ = false;
+  const CancellationToken* parent_ = nullptr;
+};
+
+// Token may be missing, if compilation can't be cancelled.
+inline void ThrowIfCancelled(const CancellationToken* token) {
+  if (token != nullptr) {
+    token->ThrowIfCancelled();
+  }
+}
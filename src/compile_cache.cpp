@@ -0,0 +1,159 @@
+#include "compile_cache.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+#include "content_hash.hpp"
+
+namespace {
+
+uint64_t KeyOf(const std::string& path, uint64_t text_hash) {
+  return HashCombine(HashContent(path), text_hash);
+}
+
+// Order of modules depends on the compilation, not on the inputs.
+uint64_t InputsHashOf(const std::vector<OpenedModule>& modules) {
+  std::vector<uint64_t> hashes;
+  hashes.reserve(modules.size());
+  for (const OpenedModule& module: modules) {
+    uint64_t path_hash = HashContent(module.path);
+    hashes.push_back(module.hash.has_value() ? HashCombine(path_hash, *module.hash) : path_hash);
+  }
+  std::sort(hashes.begin(), hashes.end());
+
+  uint64_t hash = modules.size();
+  for (uint64_t module_hash: hashes) {
+    hash = HashCombine(hash, module_hash);
+  }
+  return hash;
+}
+
+}  // namespace
+
+CompileCache::CompileCache(ModuleSourceCache* sources, size_t capacity)
+  : sources_(sources), capacity_(capacity) {
+    assert(sources_ != nullptr);
+}
+
+void CompileCache::SetCapacity(size_t capacity) {
+  std::list<Entry> evicted;
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity_ = capacity;
+  Evict(&evicted);
+}
+
+std::optional<CachedCompilation> CompileCache::Find(const std::string& path, uint64_t text_hash, const SourceOverlay& overlay) {
+  uint64_t key = KeyOf(path, text_hash);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto [begin, end] = by_key_.equal_range(key);
+  for (auto it = begin; it != end; ++it) {
+    auto entry_it = it->second;
+    if (!sources_->Unchanged(entry_it->compilation.modules, overlay)) {
+      continue;
+    }
+
+    entries_.splice(entries_.begin(), entries_, entry_it);
+    return entry_it->compilation;
+  }
+
+  return std::nullopt;
+}
+
+void CompileCache::Insert(const std::string& path, uint64_t text_hash, CachedCompilation compilation) {
+  uint64_t key = KeyOf(path, text_hash);
+  uint64_t inputs_hash = InputsHashOf(compilation.modules);
+
+  // The last reference to a driver may go away with an evicted entry,
+  //   not under the lock.
+  std::list<Entry> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0) {
+      return;
+    }
+
+    auto [begin, end] = by_key_.equal_range(key);
+    for (auto it = begin; it != end; ++it) {
+      if (it->second->inputs_hash == inputs_hash) {
+        evicted.splice(evicted.end(), entries_, it->second);
+        by_key_.erase(it);
+        break;
+      }
+    }
+
+    entries_.push_front(Entry{
+      path: path,
+      key: key,
+      inputs_hash: inputs_hash,
+      compilation: std::move(compilation),
+    });
+    by_key_.emplace(key, entries_.begin());
+
+    EvictOf(path, &evicted);
+    Evict(&evicted);
+  }
+}
+
+size_t CompileCache::BytesOf(const std::string& path, const LSPCompilationDriver* except) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  size_t bytes = 0;
+  for (const Entry& entry: entries_) {
+    const FileSnapshot* snapshot = entry.compilation.snapshot.get();
+    if (entry.path == path && snapshot != nullptr && snapshot->Driver() != except) {
+      bytes += snapshot->MemoryBytes();
+    }
+  }
+  return bytes;
+}
+
+void CompileCache::Remove(const std::string& path, const LSPCompilationDriver* except) {
+  std::list<Entry> removed;
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto it = by_key_.begin(); it != by_key_.end();) {
+    const Entry& entry = *it->second;
+    const FileSnapshot* snapshot = entry.compilation.snapshot.get();
+    if (entry.path == path && (snapshot == nullptr || snapshot->Driver() != except)) {
+      removed.splice(removed.end(), entries_, it->second);
+      it = by_key_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void CompileCache::Evict(std::list<Entry>* evicted) {
+  while (entries_.size() > capacity_) {
+    Unlink(std::prev(entries_.end()), evicted);
+  }
+}
+
+void CompileCache::EvictOf(const std::string& path, std::list<Entry>* evicted) {
+  size_t kept = 0;
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    auto entry_it = it++;
+    if (entry_it->path != path) {
+      continue;
+    }
+    if (kept < kMaxPerFile) {
+      kept += 1;
+    } else {
+      Unlink(entry_it, evicted);
+    }
+  }
+}
+
+void CompileCache::Unlink(std::list<Entry>::iterator entry_it, std::list<Entry>* evicted) {
+  auto [begin, end] = by_key_.equal_range(entry_it->key);
+  for (auto it = begin; it != end; ++it) {
+    if (it->second == entry_it) {
+      by_key_.erase(it);
+      break;
+    }
+  }
+  evicted->splice(evicted->end(), entries_, entry_it);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// LibLsp.
+#include "LibLsp/lsp/textDocument/publishDiagnostics.h"
+
+#include "file_snapshot.hpp"
+#include "module_cache.hpp"
+
+// What a compilation of a file has produced, and from what.
+struct CachedCompilation {
+  // Every module it has read, the file itself included, with hashes,
+  //   and every place a module wasn't found at. Up to the module that
+  //   failed, if it failed.
+  std::vector<OpenedModule> modules;
+
+  std::optional<lsDiagnostic> diagnostic;
+
+  // Missing, if the compilation failed.
+  std::shared_ptr<const FileSnapshot> snapshot;
+};
+
+// Results of recent compilations, given out again when the same inputs
+//   come back: undo and redo, a line toggled back and forth, a branch
+//   switched back. Compilation is deterministic, the same modules give
+//   the same result.
+//
+// What a file imports depends on its text, so entries are found by
+//   the file and the hash of its text first, then checked against
+//   the current texts of every module they have read (see
+//   ModuleSourceCache::Unchanged). Least recently used entries go first,
+//   once there are more than the capacity, or more than kMaxPerFile of
+//   one file.
+//
+// An entry keeps the whole driver alive, so there are few of them. With
+//   a memory budget they are dropped first, see enforce_memory_budget.
+class CompileCache {
+public:
+  explicit CompileCache(ModuleSourceCache* sources, size_t capacity = kDefaultCapacity);
+
+  static constexpr size_t kDefaultCapacity = 8;
+
+  // The current compilation of the file and the couple before it: enough
+  //   for an undo and a redo, one file edited for long doesn't push out
+  //   the others.
+  static constexpr size_t kMaxPerFile = 3;
+
+  // Zero turns the cache off.
+  void SetCapacity(size_t capacity);
+
+  std::optional<CachedCompilation> Find(const std::string& path, uint64_t text_hash, const SourceOverlay& overlay);
+
+  void Insert(const std::string& path, uint64_t text_hash, CachedCompilation compilation);
+
+  // Heap kept by the compilations of the file, except the one of `except`
+  //   driver (it's counted elsewhere). See FileSnapshot::MemoryBytes.
+  size_t BytesOf(const std::string& path, const LSPCompilationDriver* except) const;
+
+  // Drops the compilations of the file, except the one of `except`.
+  void Remove(const std::string& path, const LSPCompilationDriver* except = nullptr);
+
+private:
+  struct Entry {
+    std::string path;
+    uint64_t key = 0;
+    // Of the file and of every module it has read, tells apart entries
+    //   of the same text.
+    uint64_t inputs_hash = 0;
+    CachedCompilation compilation;
+  };
+
+  // Must be called with mutex_ held. Entries over the capacity are moved
+  //   to evicted, to be destroyed after the lock is released.
+  void Evict(std::list<Entry>* evicted);
+
+  // Must be called with mutex_ held. Same, for entries of the file over
+  //   kMaxPerFile.
+  void EvictOf(const std::string& path, std::list<Entry>* evicted);
+
+  // Must be called with mutex_ held.
+  void Unlink(std::list<Entry>::iterator entry_it, std::list<Entry>* evicted);
+
+  ModuleSourceCache* sources_;
+
+  mutable std::mutex mutex_;
+  size_t capacity_;
+
+  // Most recently used first.
+  std::list<Entry> entries_;
+  std::unordered_multimap<uint64_t, std::list<Entry>::iterator> by_key_;
+};
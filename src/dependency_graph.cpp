@@ -0,0 +1,54 @@
+#include "dependency_graph.hpp"
+
+#include <algorithm>
+#include <utility>
+
+void DependencyGraph::SetDependencies(const std::string& file, std::vector<std::string> dependencies) {
+  Remove(file);
+
+  std::sort(dependencies.begin(), dependencies.end());
+  dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+  std::erase(dependencies, file);
+
+  for (const std::string& dependency: dependencies) {
+    importers_[dependency].insert(file);
+  }
+  dependencies_[file] = std::move(dependencies);
+}
+
+void DependencyGraph::Remove(const std::string& file) {
+  auto it = dependencies_.find(file);
+  if (it == dependencies_.end()) {
+    return;
+  }
+
+  for (const std::string& dependency: it->second) {
+    auto importers_it = importers_.find(dependency);
+    if (importers_it == importers_.end()) {
+      continue;
+    }
+
+    importers_it->second.erase(file);
+    if (importers_it->second.empty()) {
+      importers_.erase(importers_it);
+    }
+  }
+
+  dependencies_.erase(it);
+}
+
+const std::vector<std::string>& DependencyGraph::DependenciesOf(const std::string& file) const {
+  static const std::vector<std::string> kNone;
+
+  auto it = dependencies_.find(file);
+  return it != dependencies_.end() ? it->second : kNone;
+}
+
+std::vector<std::string> DependencyGraph::ImportersOf(const std::string& module_path) const {
+  auto it = importers_.find(module_path);
+  if (it == importers_.end()) {
+    return {};
+  }
+
+  return std::vector<std::string>(it->second.begin(), it->second.end());
+}
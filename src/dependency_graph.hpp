@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Which open files import which modules. Dependencies of a file are all
+//   modules its last compilation opened (and places it looked for one at,
+//   but found nothing: see OpenedModule), so they are already transitive:
+//   if A imports B and B imports C, C is a dependency of A as well. Then
+//   importers of a module, directly or not, are a single lookup.
+//
+// Files and modules are identified by normalized absolute paths.
+class DependencyGraph {
+public:
+  // Replaces what was known about the file.
+  void SetDependencies(const std::string& file, std::vector<std::string> dependencies);
+
+  void Remove(const std::string& file);
+
+  const std::vector<std::string>& DependenciesOf(const std::string& file) const;
+
+  // Open files, which import the module, directly or not.
+  std::vector<std::string> ImportersOf(const std::string& module_path) const;
+
+private:
+  std::unordered_map<std::string, std::vector<std::string>> dependencies_;
+  std::unordered_map<std::string, std::unordered_set<std::string>> importers_;
+};
@@ -0,0 +1,305 @@
+#include "edited_file.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include "content_hash.hpp"
+#include "newline_scan.hpp"
+
+EditedFile::Node::Node(std::string chunk, uint32_t prio)
+  : text(std::move(chunk)), priority(prio) {
+  newline_scan::FindNewlines(text, newline_offsets);
+  subtree_bytes = text.size();
+  subtree_newlines = newline_offsets.size();
+}
+
+EditedFile::Node::Node(std::string chunk, std::vector<uint16_t> newlines, uint32_t prio)
+  : text(std::move(chunk)), newline_offsets(std::move(newlines)), priority(prio) {
+  subtree_bytes = text.size();
+  subtree_newlines = newline_offsets.size();
+}
+
+size_t EditedFile::Bytes(const NodePtr& node) {
+  return node != nullptr ? node->subtree_bytes : 0;
+}
+
+size_t EditedFile::Newlines(const NodePtr& node) {
+  return node != nullptr ? node->subtree_newlines : 0;
+}
+
+void EditedFile::Update(Node* node) {
+  node->subtree_bytes    = Bytes(node->left)    + node->text.size() + Bytes(node->right);
+  node->subtree_newlines = Newlines(node->left) + node->newline_offsets.size() + Newlines(node->right);
+}
+
+EditedFile::NodePtr EditedFile::MakeNode(std::string chunk) {
+  return std::make_unique<Node>(std::move(chunk), static_cast<uint32_t>(rng_()));
+}
+
+EditedFile::NodePtr EditedFile::MakeNode(std::string chunk, std::vector<uint16_t> newlines) {
+  return std::make_unique<Node>(std::move(chunk), std::move(newlines), static_cast<uint32_t>(rng_()));
+}
+
+std::pair<EditedFile::NodePtr, EditedFile::NodePtr> EditedFile::Split(NodePtr node, size_t bytes) {
+  if (node == nullptr) {
+    return {nullptr, nullptr};
+  }
+
+  size_t left_bytes = Bytes(node->left);
+
+  if (bytes <= left_bytes) {
+    auto [lhs, rhs] = Split(std::move(node->left), bytes);
+    node->left = std::move(rhs);
+    Update(node.get());
+    return {std::move(lhs), std::move(node)};
+  }
+
+  if (bytes >= left_bytes + node->text.size()) {
+    auto [lhs, rhs] = Split(std::move(node->right), bytes - left_bytes - node->text.size());
+    node->right = std::move(lhs);
+    Update(node.get());
+    return {std::move(node), std::move(rhs)};
+  }
+
+  // Граница внутри куска текста этой вершины. Правую часть куска
+  //   выделим в отдельную вершину, она пойдет в правое дерево.
+  //   Переводы строк заново не ищем, делим уже найденные.
+  size_t cut = bytes - left_bytes;
+  auto& offsets = node->newline_offsets;
+  auto first_in_tail = std::lower_bound(offsets.begin(), offsets.end(), cut);
+
+  std::vector<uint16_t> tail_offsets;
+  tail_offsets.reserve(static_cast<size_t>(offsets.end() - first_in_tail));
+  for (auto it = first_in_tail; it != offsets.end(); ++it) {
+    tail_offsets.push_back(static_cast<uint16_t>(*it - cut));
+  }
+  offsets.erase(first_in_tail, offsets.end());
+
+  NodePtr tail = MakeNode(node->text.substr(cut), std::move(tail_offsets));
+  node->text.resize(cut);
+
+  NodePtr right = std::move(node->right);
+  Update(node.get());
+
+  return {std::move(node), Merge(std::move(tail), std::move(right))};
+}
+
+EditedFile::NodePtr EditedFile::Merge(NodePtr lhs, NodePtr rhs) {
+  if (lhs == nullptr) {
+    return rhs;
+  }
+  if (rhs == nullptr) {
+    return lhs;
+  }
+
+  if (lhs->priority > rhs->priority) {
+    lhs->right = Merge(std::move(lhs->right), std::move(rhs));
+    Update(lhs.get());
+    return lhs;
+  }
+
+  rhs->left = Merge(std::move(lhs), std::move(rhs->left));
+  Update(rhs.get());
+  return rhs;
+}
+
+EditedFile::NodePtr EditedFile::Build(std::string_view text) {
+  if (text.empty()) {
+    return nullptr;
+  }
+
+  size_t num_chunks = (text.size() + kMaxChunkSize - 1) / kMaxChunkSize;
+  size_t chunk_size = (text.size() + num_chunks - 1) / num_chunks;
+
+  NodePtr result;
+  for (size_t pos = 0; pos < text.size(); pos += chunk_size) {
+    result = Merge(std::move(result), MakeNode(std::string(text.substr(pos, chunk_size))));
+  }
+
+  return result;
+}
+
+void EditedFile::set_content(std::string new_content) {
+  rng_.seed(std::minstd_rand::default_seed);
+  root_ = Build(new_content);
+
+  flat_ = std::make_shared<const std::string>(std::move(new_content));
+  flat_hash_.reset();
+}
+
+void EditedFile::Replace(size_t start, size_t end, std::string_view replacement) {
+  assert(start <= end);
+  assert(end <= size());
+
+  auto [left, rest] = Split(std::move(root_), start);
+  auto [removed, right] = Split(std::move(rest), end - start);
+  removed.reset();
+
+  // Заберем себе соседние куски и разрежем заново вместе с вставкой.
+  //   Иначе после множества мелких правок дерево будет состоять из
+  //   кусков по одному символу. Так соседние куски всегда не меньше
+  //   половины максимального размера (если файл не совсем маленький).
+  size_t left_tail_size = 0;
+  for (const Node* node = left.get(); node != nullptr; node = node->right.get()) {
+    left_tail_size = node->text.size();
+  }
+  size_t left_size = Bytes(left);
+  auto [left_rest, left_tail] = Split(std::move(left), left_size - left_tail_size);
+
+  size_t right_head_size = 0;
+  for (const Node* node = right.get(); node != nullptr; node = node->left.get()) {
+    right_head_size = node->text.size();
+  }
+  auto [right_head, right_rest] = Split(std::move(right), right_head_size);
+
+  std::string merged;
+  merged.reserve(left_tail_size + replacement.size() + right_head_size);
+  if (left_tail != nullptr) {
+    merged += left_tail->text;
+  }
+  merged += replacement;
+  if (right_head != nullptr) {
+    merged += right_head->text;
+  }
+
+  root_ = Merge(Merge(std::move(left_rest), Build(merged)), std::move(right_rest));
+  flat_.reset();
+  flat_hash_.reset();
+}
+
+void EditedFile::update_content(lsRange range, std::string_view replacement) {
+  size_t edited_start = offset_of(range.start);
+  size_t edited_end   = offset_of(range.end);
+
+  Replace(edited_start, edited_end, replacement);
+}
+
+size_t EditedFile::size() const {
+  return Bytes(root_);
+}
+
+size_t EditedFile::line_count() const {
+  return Newlines(root_) + 1;
+}
+
+size_t EditedFile::line_start(size_t line) const {
+  assert(line < line_count());
+
+  if (line == 0) {
+    // Первая строка начинается с первого байта.
+    return 0;
+  }
+
+  // Ищем line-ый перевод строки, строка начинается после него.
+  size_t remaining = line;
+  size_t base = 0;
+  const Node* node = root_.get();
+  while (node != nullptr) {
+    size_t left_newlines = Newlines(node->left);
+    if (remaining <= left_newlines) {
+      node = node->left.get();
+      continue;
+    }
+
+    base += Bytes(node->left);
+    remaining -= left_newlines;
+
+    const auto& offsets = node->newline_offsets;
+    if (remaining <= offsets.size()) {
+      return base + offsets[remaining - 1] + 1;
+    }
+
+    base += node->text.size();
+    remaining -= offsets.size();
+    node = node->right.get();
+  }
+
+  assert(false && "BUG: newline counter of the tree is wrong.");
+  return size();
+}
+
+size_t EditedFile::offset_of(lsPosition position) const {
+  assert(position.line >= 0);
+  assert(position.character >= 0);
+  assert(static_cast<size_t>(position.line) < line_count());
+
+  size_t line = static_cast<size_t>(position.line);
+  size_t start = line_start(line);
+
+  // Конец строки -- перевод строки, не включая его, или конец файла.
+  size_t end = line + 1 < line_count() ? line_start(line + 1) - 1 : size();
+
+  return std::min(start + static_cast<size_t>(position.character), end);
+}
+
+std::string EditedFile::substr(size_t offset, size_t length) const {
+  std::string result;
+  if (offset >= size()) {
+    return result;
+  }
+  length = std::min(length, size() - offset);
+  result.reserve(length);
+
+  if (flat_ != nullptr) {
+    result.append(*flat_, offset, length);
+    return result;
+  }
+
+  // Поддеревья вне интервала не посещаются, так что это
+  //   O(log n + число затронутых кусков).
+  size_t end = offset + length;
+  auto collect = [&](auto&& self, const Node* current, size_t current_base) -> void {
+    if (current == nullptr || current_base >= end || current_base + current->subtree_bytes <= offset) {
+      return;
+    }
+
+    self(self, current->left.get(), current_base);
+
+    size_t text_start = current_base + Bytes(current->left);
+    size_t text_end = text_start + current->text.size();
+    if (text_start < end && offset < text_end) {
+      size_t from = std::max(offset, text_start);
+      size_t to = std::min(end, text_end);
+      result.append(current->text, from - text_start, to - from);
+    }
+
+    self(self, current->right.get(), text_end);
+  };
+  collect(collect, root_.get(), 0);
+
+  return result;
+}
+
+const std::string& EditedFile::content() const {
+  return *snapshot();
+}
+
+std::shared_ptr<const std::string> EditedFile::snapshot() const {
+  if (flat_ != nullptr) {
+    return flat_;
+  }
+
+  std::string flat;
+  flat.reserve(size());
+
+  auto append = [&](auto&& self, const Node* node) -> void {
+    if (node == nullptr) {
+      return;
+    }
+    self(self, node->left.get());
+    flat += node->text;
+    self(self, node->right.get());
+  };
+  append(append, root_.get());
+
+  flat_ = std::make_shared<const std::string>(std::move(flat));
+  return flat_;
+}
+
+uint64_t EditedFile::content_hash() const {
+  if (!flat_hash_.has_value()) {
+    flat_hash_ = HashContent(content());
+  }
+  return flat_hash_.value();
+}
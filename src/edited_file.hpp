@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// LibLsp.
+#include "LibLsp/lsp/lsRange.h"
+
+// Text of a document opened in the editor.
+//
+// Stored as a rope: an implicit treap of chunks (each is at most kMaxChunkSize
+//   bytes). Every node keeps the number of bytes and of line feeds in its
+//   subtree, that is our line index. So an edit is a couple of splits and
+//   merges, O(log n) in the file size plus O(chunk size) for the chunks around
+//   the edit, instead of shifting the whole tail of a flat string.
+// Line starts after the edit are never rewritten: they are sums over the
+//   tree, so the byte delta of an edit is applied to them implicitly. Only
+//   the chunks around the edit are scanned for line feeds.
+//
+// Lines are separated by '\n', line feed belongs to the line it ends. Line k
+//   starts right after the k-th line feed. If the file ends with '\n', there
+//   is an empty last line after it: editors may put the cursor there and send
+//   edits at that position.
+class EditedFile {
+public:
+  EditedFile() = default;
+
+  EditedFile(EditedFile&& other) = default;
+  EditedFile& operator=(EditedFile&& other) = default;
+
+  EditedFile(const EditedFile& other) = delete;
+  EditedFile& operator=(const EditedFile& other) = delete;
+
+  void set_content(std::string new_content);
+
+  void update_content(lsRange range, std::string_view replacement);
+
+  size_t size() const;
+  size_t line_count() const;
+
+  // Byte offset of the first byte of the line.
+  size_t line_start(size_t line) const;
+
+  // Byte offset of the position. Characters past the end of line are
+  //   clamped to the end of line, as specification requires.
+  size_t offset_of(lsPosition position) const;
+
+  // Copies [offset, offset + length) without flattening the whole text.
+  //   Range is clamped to the end of file.
+  std::string substr(size_t offset, size_t length) const;
+
+  // Contiguous copy of the text, for the compiler. Built on the first call
+  //   after a modification, repeated calls are free.
+  const std::string& content() const;
+
+  // Same copy, but shared: it stays alive and unchanged after further
+  //   edits. Compilation may read it without holding locks of the file.
+  std::shared_ptr<const std::string> snapshot() const;
+
+  // HashContent of the text, cached the same way.
+  uint64_t content_hash() const;
+
+private:
+  static constexpr size_t kMaxChunkSize = 1024;
+  static_assert(kMaxChunkSize <= UINT16_MAX);
+
+  struct Node;
+  using NodePtr = std::unique_ptr<Node>;
+
+  struct Node {
+    Node(std::string chunk, uint32_t prio);
+    Node(std::string chunk, std::vector<uint16_t> newlines, uint32_t prio);
+
+    std::string text;
+
+    // Offsets of line feeds inside of text. Chunks are small, 16 bits
+    //   are enough.
+    std::vector<uint16_t> newline_offsets;
+
+    size_t subtree_bytes = 0;
+    size_t subtree_newlines = 0;
+
+    uint32_t priority = 0;
+
+    NodePtr left;
+    NodePtr right;
+  };
+
+  static size_t Bytes(const NodePtr& node);
+  static size_t Newlines(const NodePtr& node);
+  static void Update(Node* node);
+
+  // First `bytes` bytes go to the left tree, the rest to the right one.
+  //   A chunk is cut in two, if the boundary is inside of it.
+  std::pair<NodePtr, NodePtr> Split(NodePtr node, size_t bytes);
+  static NodePtr Merge(NodePtr lhs, NodePtr rhs);
+
+  // Cuts text into chunks of almost equal size, at most kMaxChunkSize each.
+  NodePtr Build(std::string_view text);
+
+  NodePtr MakeNode(std::string chunk);
+  NodePtr MakeNode(std::string chunk, std::vector<uint16_t> newlines);
+
+  void Replace(size_t start, size_t end, std::string_view replacement);
+
+  NodePtr root_;
+
+  // Priorities of the treap. Seeded with a constant, so that the tree shape
+  //   is reproducible between runs.
+  std::minstd_rand rng_;
+
+  // Null after a modification, until someone asks for the contiguous text.
+  mutable std::shared_ptr<const std::string> flat_ = std::make_shared<const std::string>();
+  mutable std::optional<uint64_t> flat_hash_;
+};
@@ -0,0 +1,166 @@
+#include "file_snapshot.hpp"
+
+#include <utility>
+
+#include "async_log.hpp"
+
+FileSnapshot::FileSnapshot(
+  uint64_t version,
+  std::optional<lsDiagnostic> diagnostic,
+  std::shared_ptr<LSPCompilationDriver> driver,
+  SymbolTable symbols,
+  UsageIndex usages,
+  TypeNames type_names,
+  size_t memory_bytes
+)
+  : version_(version)
+  , compiled_version_(version)
+  , diagnostic_(std::move(diagnostic))
+  , driver_(std::move(driver))
+  , memory_bytes_(memory_bytes)
+  , type_names_(std::make_shared<const TypeNames>(std::move(type_names)))
+  , symbols_(std::make_shared<const SymbolTable>(std::move(symbols)))
+  , usages_(std::make_shared<const UsageIndex>(std::move(usages))) {}
+
+// Everything but the outline, which is built anew if asked.
+FileSnapshot::FileSnapshot(const FileSnapshot& other, uint64_t version)
+  : version_(version)
+  , compiled_version_(other.compiled_version_)
+  , diagnostic_(other.diagnostic_)
+  , driver_(other.driver_)
+  , memory_bytes_(other.memory_bytes_)
+  , type_names_(other.type_names_)
+  , symbols_(other.symbols_)
+  , usages_(other.usages_)
+  , shifts_(other.shifts_) {}
+
+// Results of the last compilation follow the text until the next one:
+//   symbols and usages after the edit move with it, those the edit
+//   touches are dropped. Declarations after the edit can only be
+//   referenced by what is after it, so the rest of usages still point
+//   where they should. Unless the edit changes scopes, then the next
+//   compilation fixes it.
+//
+// Usually the next compilation comes after a few edits, they are kept
+//   aside until then. Otherwise (it fails) they are applied to copies.
+std::shared_ptr<const FileSnapshot> FileSnapshot::WithEdits(uint64_t version, const std::vector<PositionShift>& shifts) const {
+  // Private constructor, make_shared can't reach it.
+  std::shared_ptr<FileSnapshot> next(new FileSnapshot(*this, version));
+  next->shifts_.insert(next->shifts_.end(), shifts.begin(), shifts.end());
+  if (next->shifts_.size() <= kMaxPendingShifts) {
+    return next;
+  }
+
+  auto symbols = std::make_shared<SymbolTable>(*symbols_);
+  auto usages = std::make_shared<UsageIndex>(*usages_);
+
+  ETUDE_TRACE(
+    kInvalidation,
+    "Before ApplyEdit symbols.size() = {}, usages.size() = {}",
+    symbols->size(),
+    usages->size()
+  );
+
+  for (const PositionShift& shift: next->shifts_) {
+    symbols->ApplyEdit(shift);
+    usages->ApplyEdit(shift);
+  }
+
+  ETUDE_TRACE(
+    kInvalidation,
+    "After ApplyEdit symbols.size() = {}, usages.size() = {}",
+    symbols->size(),
+    usages->size()
+  );
+
+  next->symbols_ = std::move(symbols);
+  next->usages_ = std::move(usages);
+  next->shifts_.clear();
+  return next;
+}
+
+std::shared_ptr<const FileSnapshot> FileSnapshot::WithVersion(uint64_t version) const {
+  std::shared_ptr<FileSnapshot> next(new FileSnapshot(*this, version));
+  if (compiled_version_ == version_) {
+    next->compiled_version_ = version;
+  }
+  return next;
+}
+
+std::shared_ptr<const FileSnapshot> FileSnapshot::WithDiagnostic(uint64_t version, std::optional<lsDiagnostic> diagnostic) const {
+  std::shared_ptr<FileSnapshot> next(new FileSnapshot(*this, version));
+  next->diagnostic_ = std::move(diagnostic);
+  return next;
+}
+
+std::string FileSnapshot::TypeName(types::Type* type) const {
+  return type_names_->Format(type);
+}
+
+const std::vector<lsDocumentSymbol>& FileSnapshot::Outline() const {
+  std::call_once(outline_once_, [this] {
+    if (shifts_.empty()) {
+      outline_ = symbols_->ToLsp();
+      return;
+    }
+
+    SymbolTable symbols = *symbols_;
+    for (const PositionShift& shift: shifts_) {
+      symbols.ApplyEdit(shift);
+    }
+    outline_ = symbols.ToLsp();
+  });
+  return outline_;
+}
+
+std::shared_ptr<const FileSnapshot> SnapshotRegistry::Get(const std::string& path) const {
+  std::shared_lock lock(mutex_);
+  auto it = snapshots_.find(path);
+  if (it == snapshots_.end()) {
+    return nullptr;
+  }
+
+  it->second.last_used.store(clock_.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  return it->second.snapshot;
+}
+
+void SnapshotRegistry::Publish(const std::string& path, std::shared_ptr<const FileSnapshot> snapshot) {
+  std::shared_ptr<const FileSnapshot> previous;
+  {
+    std::unique_lock lock(mutex_);
+    auto [it, inserted] = snapshots_.try_emplace(path);
+    if (inserted) {
+      it->second.last_used.store(clock_.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    previous = std::exchange(it->second.snapshot, std::move(snapshot));
+  }
+  // The last reference may be here, then the driver goes away with it.
+  //   Not under the lock.
+}
+
+void SnapshotRegistry::Remove(const std::string& path) {
+  std::shared_ptr<const FileSnapshot> previous;
+  {
+    std::unique_lock lock(mutex_);
+    auto it = snapshots_.find(path);
+    if (it == snapshots_.end()) {
+      return;
+    }
+    previous = std::move(it->second.snapshot);
+    snapshots_.erase(it);
+  }
+}
+
+void SnapshotRegistry::Touch(const std::string& path) const {
+  std::shared_lock lock(mutex_);
+  auto it = snapshots_.find(path);
+  if (it != snapshots_.end()) {
+    it->second.last_used.store(clock_.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+}
+
+uint64_t SnapshotRegistry::LastUsed(const std::string& path) const {
+  std::shared_lock lock(mutex_);
+  auto it = snapshots_.find(path);
+  return it != snapshots_.end() ? it->second.last_used.load(std::memory_order_relaxed) : 0;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// LibLsp.
+#include "LibLsp/lsp/textDocument/publishDiagnostics.h"
+#include "LibLsp/lsp/textDocument/document_symbol.h"
+
+#include "lsp_driver.hpp"
+#include "packed_position.hpp"
+#include "symbol_table.hpp"
+#include "type_names.hpp"
+#include "usage_index.hpp"
+
+// What queries need of an open file: results of its last successful
+//   compilation, moved along with the edits since, and the diagnostic
+//   of the last compilation.
+//
+// Never changes once made. Edits and compilations make a new snapshot
+//   and publish it (see SnapshotRegistry), queries hold on to the one
+//   they started with and read it without any locks. Driver, which owns
+//   types and compilation units usages point to, lives as long as some
+//   snapshot refers to it.
+class FileSnapshot {
+public:
+  // Nothing is known yet.
+  FileSnapshot() = default;
+
+  FileSnapshot(
+    uint64_t version,
+    std::optional<lsDiagnostic> diagnostic,
+    std::shared_ptr<LSPCompilationDriver> driver,
+    SymbolTable symbols,
+    UsageIndex usages,
+    TypeNames type_names = TypeNames(),
+    size_t memory_bytes = 0
+  );
+
+  FileSnapshot(const FileSnapshot&) = delete;
+  FileSnapshot& operator=(const FileSnapshot&) = delete;
+
+  // Same results, following edits of the text. Indexes are shared,
+  //   edits are applied when queries read them (see EditedUsages).
+  std::shared_ptr<const FileSnapshot> WithEdits(uint64_t version, const std::vector<PositionShift>& shifts) const;
+
+  // Same results for another version of the same text, which has come
+  //   back (see CompileCache).
+  std::shared_ptr<const FileSnapshot> WithVersion(uint64_t version) const;
+
+  // Same results, but another diagnostic. Compilation failed, the last
+  //   successful results are still the best we have.
+  std::shared_ptr<const FileSnapshot> WithDiagnostic(uint64_t version, std::optional<lsDiagnostic> diagnostic) const;
+
+  // Version of the text, which positions are for.
+  uint64_t Version() const {
+    return version_;
+  }
+
+  // Version of the text, which was compiled. Older than Version(), once
+  //   results are moved along edits: usages the edits touched are dropped
+  //   then, see UsageIndex::ApplyEdit.
+  uint64_t CompiledVersion() const {
+    return compiled_version_;
+  }
+
+  const std::optional<lsDiagnostic>& Diagnostic() const {
+    return diagnostic_;
+  }
+
+  EditedUsages Usages() const {
+    return EditedUsages(usages_.get(), &shifts_);
+  }
+
+  // Null, if nothing has compiled yet.
+  LSPCompilationDriver* Driver() const {
+    return driver_.get();
+  }
+
+  // Heap the compilation has kept: driver, types, indexes. Estimated
+  //   by the modules of the driver, see EstimateCompiledBytes.
+  size_t MemoryBytes() const {
+    return memory_bytes_;
+  }
+
+  // See TypeNames, names are made by the compilation and shared by all
+  //   its snapshots. Takes no locks.
+  std::string TypeName(types::Type* type) const;
+
+  // Editors ask for the outline after every change and on focus. Built
+  //   on the first request.
+  const std::vector<lsDocumentSymbol>& Outline() const;
+
+private:
+  // Each query pays a step per edit. After so many, edits are applied
+  //   to copies of the indexes once.
+  static constexpr size_t kMaxPendingShifts = 128;
+
+  FileSnapshot(const FileSnapshot& other, uint64_t version);
+
+  uint64_t version_ = 0;
+  uint64_t compiled_version_ = 0;
+  std::optional<lsDiagnostic> diagnostic_;
+
+  std::shared_ptr<LSPCompilationDriver> driver_;
+  size_t memory_bytes_ = 0;
+  std::shared_ptr<const TypeNames> type_names_ = std::make_shared<const TypeNames>();
+
+  // Of the compilation, shared by snapshots following edits.
+  std::shared_ptr<const SymbolTable> symbols_;
+  std::shared_ptr<const UsageIndex> usages_;
+
+  // Edits since, oldest first.
+  std::vector<PositionShift> shifts_;
+
+  mutable std::once_flag outline_once_;
+  mutable std::vector<lsDocumentSymbol> outline_;
+};
+
+// Latest snapshot of every open file, by the path used in file_cache.
+//   Publishing swaps a pointer, readers copy it and leave, so nobody
+//   holds the lock for longer than that.
+//
+// Also remembers when each file was last used (queried, edited, opened),
+//   for the memory budget to drop the least recently used ones first.
+class SnapshotRegistry {
+public:
+  // Null, if the file isn't open or its compiled state was dropped.
+  //   Counts as a use.
+  std::shared_ptr<const FileSnapshot> Get(const std::string& path) const;
+
+  void Publish(const std::string& path, std::shared_ptr<const FileSnapshot> snapshot);
+
+  void Remove(const std::string& path);
+
+  void Touch(const std::string& path) const;
+
+  // Larger is more recent. Zero, if never used.
+  uint64_t LastUsed(const std::string& path) const;
+
+private:
+  struct Entry {
+    std::shared_ptr<const FileSnapshot> snapshot;
+    // Readers update it under the shared lock.
+    mutable std::atomic<uint64_t> last_used = 0;
+  };
+
+  mutable std::shared_mutex mutex_;
+  std::unordered_map<std::string, Entry> snapshots_;
+
+  mutable std::atomic<uint64_t> clock_ = 0;
+};
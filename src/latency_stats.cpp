@@ -0,0 +1,167 @@
+#include "latency_stats.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include <fmt/format.h>
+
+void LatencyHistogram::Record(std::chrono::nanoseconds duration) {
+  uint64_t value = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+
+  buckets_[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+
+  uint64_t max = max_.load(std::memory_order_relaxed);
+  while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+std::chrono::nanoseconds LatencyHistogram::Mean() const {
+  uint64_t count = Count();
+  if (count == 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  return std::chrono::nanoseconds(sum_.load(std::memory_order_relaxed) / count);
+}
+
+std::chrono::nanoseconds LatencyHistogram::Max() const {
+  return std::chrono::nanoseconds(max_.load(std::memory_order_relaxed));
+}
+
+std::chrono::nanoseconds LatencyHistogram::Percentile(double quantile) const {
+  uint64_t count = Count();
+  if (count == 0) {
+    return std::chrono::nanoseconds(0);
+  }
+
+  uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * count + 0.5));
+  uint64_t seen = 0;
+  for (size_t bucket = 0; bucket < kBuckets; bucket += 1) {
+    seen += buckets_[bucket].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      // Bound of the bucket may be above the largest value recorded.
+      return std::min(std::chrono::nanoseconds(BucketUpperBound(bucket)), Max());
+    }
+  }
+  return Max();
+}
+
+void LatencyHistogram::Reset() {
+  for (auto& bucket: buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+size_t LatencyHistogram::BucketOf(uint64_t value) {
+  // First kSubBuckets values have a bucket each.
+  if (value < kSubBuckets) {
+    return value;
+  }
+
+  // Then every [2^k, 2^(k+1)) is split into kSubBuckets equal parts.
+  uint32_t magnitude = std::bit_width(value) - 1;
+  uint32_t shift = magnitude - kSubBucketBits;
+  size_t sub_bucket = (value >> shift) & (kSubBuckets - 1);
+  return (shift + 1) * kSubBuckets + sub_bucket;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+
+  uint32_t shift = static_cast<uint32_t>(bucket / kSubBuckets) - 1;
+  uint64_t sub_bucket = bucket % kSubBuckets;
+  uint64_t lower = (kSubBuckets + sub_bucket) << shift;
+  return lower + ((uint64_t{1} << shift) - 1);
+}
+
+namespace latency_stats {
+
+namespace {
+
+struct Registry {
+  std::mutex mutex;
+  // Nodes of std::map are stable, references stay valid.
+  std::map<std::string, LatencyHistogram, std::less<>> histograms;
+};
+
+Registry& Instance() {
+  static Registry registry;
+  return registry;
+}
+
+}  // namespace
+
+LatencyHistogram& Get(std::string_view name) {
+  Registry& registry = Instance();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+
+  auto it = registry.histograms.find(name);
+  if (it == registry.histograms.end()) {
+    it = registry.histograms.try_emplace(std::string(name)).first;
+  }
+  return it->second;
+}
+
+LatencySummary Summarize(std::string name, const LatencyHistogram& histogram) {
+  return LatencySummary{
+    name: std::move(name),
+    count: histogram.Count(),
+    mean: histogram.Mean(),
+    p50: histogram.Percentile(0.5),
+    p90: histogram.Percentile(0.9),
+    p99: histogram.Percentile(0.99),
+    max: histogram.Max(),
+  };
+}
+
+std::vector<LatencySummary> Summarize() {
+  Registry& registry = Instance();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+
+  std::vector<LatencySummary> summaries;
+  for (const auto& [name, histogram]: registry.histograms) {
+    if (histogram.Count() != 0) {
+      summaries.push_back(Summarize(name, histogram));
+    }
+  }
+  return summaries;
+}
+
+std::string Format(const std::vector<LatencySummary>& summaries) {
+  auto ms = [](std::chrono::nanoseconds duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+  };
+
+  std::string table = fmt::format(
+    "{:<40} {:>8} {:>10} {:>10} {:>10} {:>10} {:>10}\n",
+    "phase", "count", "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms"
+  );
+  for (const LatencySummary& summary: summaries) {
+    table += fmt::format(
+      "{:<40} {:>8} {:>10.3f} {:>10.3f} {:>10.3f} {:>10.3f} {:>10.3f}\n",
+      summary.name, summary.count, ms(summary.mean), ms(summary.p50), ms(summary.p90), ms(summary.p99), ms(summary.max)
+    );
+  }
+  return table;
+}
+
+void ResetAll() {
+  Registry& registry = Instance();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+
+  for (auto& [_, histogram]: registry.histograms) {
+    histogram.Reset();
+  }
+}
+
+}  // namespace latency_stats
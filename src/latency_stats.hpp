@@ -0,0 +1,109 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "trace_events.hpp"
+
+// Distribution of durations in the manner of HdrHistogram: buckets grow
+//   exponentially, each power of two is split into kSubBuckets linear
+//   ones. Any value is off by at most 1/kSubBuckets, from nanoseconds to
+//   hours, in a fixed amount of memory.
+//
+// Recording is a few relaxed atomic increments, threads don't wait for
+//   each other. Reading while recording gives a slightly inconsistent,
+//   but still meaningful picture.
+class LatencyHistogram {
+public:
+  void Record(std::chrono::nanoseconds duration);
+
+  uint64_t Count() const {
+    return count_.load(std::memory_order_relaxed);
+  }
+
+  std::chrono::nanoseconds Mean() const;
+  std::chrono::nanoseconds Max() const;
+
+  // Upper bound of the bucket with the quantile, quantile is in [0, 1].
+  std::chrono::nanoseconds Percentile(double quantile) const;
+
+  void Reset();
+
+private:
+  static constexpr uint32_t kSubBucketBits = 4;
+  static constexpr uint32_t kSubBuckets = 1u << kSubBucketBits;
+  static constexpr size_t kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  static size_t BucketOf(uint64_t value);
+  static uint64_t BucketUpperBound(size_t bucket);
+
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+  std::atomic<uint64_t> count_ = 0;
+  std::atomic<uint64_t> sum_ = 0;
+  std::atomic<uint64_t> max_ = 0;
+};
+
+struct LatencySummary {
+  std::string name;
+  uint64_t count = 0;
+  std::chrono::nanoseconds mean{0};
+  std::chrono::nanoseconds p50{0};
+  std::chrono::nanoseconds p90{0};
+  std::chrono::nanoseconds p99{0};
+  std::chrono::nanoseconds max{0};
+};
+
+// Histograms by name. Names are like "compile.parse" or
+//   "request.textDocument/hover", phases of work and requests.
+namespace latency_stats {
+
+// Histogram lives until the end of the program, so callers keep
+//   the reference (see ETUDE_TIMED_SCOPE).
+LatencyHistogram& Get(std::string_view name);
+
+LatencySummary Summarize(std::string name, const LatencyHistogram& histogram);
+
+// Histograms which have recorded anything, by name.
+std::vector<LatencySummary> Summarize();
+
+// Human-readable table of Summarize().
+std::string Format(const std::vector<LatencySummary>& summaries);
+
+void ResetAll();
+
+}  // namespace latency_stats
+
+// Records the time from construction to destruction.
+class ScopedLatencyTimer {
+public:
+  explicit ScopedLatencyTimer(LatencyHistogram* histogram)
+    : histogram_(histogram)
+    , start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedLatencyTimer() {
+    histogram_->Record(std::chrono::steady_clock::now() - start_);
+  }
+
+  ScopedLatencyTimer(const ScopedLatencyTimer&) = delete;
+  ScopedLatencyTimer& operator=(const ScopedLatencyTimer&) = delete;
+
+private:
+  LatencyHistogram* histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#define ETUDE_STATS_CONCAT_IMPL(a, b) a##b
+#define ETUDE_STATS_CONCAT(a, b) ETUDE_STATS_CONCAT_IMPL(a, b)
+
+// Times the rest of the enclosing scope. Name is looked up once per
+//   call site. If the timeline is on, the scope is also a span there
+//   (see trace_events.hpp), so name should be a string literal.
+#define ETUDE_TIMED_SCOPE(name)                                                                   \
+  static LatencyHistogram& ETUDE_STATS_CONCAT(etude_histogram_, __LINE__) = latency_stats::Get(name); \
+  ScopedLatencyTimer ETUDE_STATS_CONCAT(etude_timer_, __LINE__)(&ETUDE_STATS_CONCAT(etude_histogram_, __LINE__)); \
+  trace_events::Span ETUDE_STATS_CONCAT(etude_span_, __LINE__)(name)
@@ -2,6 +2,10 @@
 
 #include "LibLsp/JsonRpc/MessageIssue.h"
 
+#include "async_log.hpp"
+
+// Messages of LspCpp and of the server itself go to async_log. Those
+//   below the configured level are dropped before anything is copied.
 class Logger final : public lsp::Log {
 public:
     void log(Level level, std::wstring&& msg) override {
@@ -9,19 +13,42 @@ public:
     }
 
     void log(Level level, const std::wstring& msg) override {
-        std::ignore = level;
-        std::wcerr << msg << '\n';
-        std::wcerr.flush();
+        LogLevel our_level = FromLspLevel(level);
+        if (!async_log::Enabled(our_level)) {
+            return;
+        }
+
+        // Messages are ascii (method names, uris are percent-encoded).
+        std::string narrow;
+        narrow.reserve(msg.size());
+        for (wchar_t c: msg) {
+            narrow.push_back(c < 0x80 ? static_cast<char>(c) : '?');
+        }
+        async_log::Write(our_level, std::move(narrow));
     }
 
     void log(Level level, std::string&& msg) override {
-        return log(level, msg); // log(Level, const std::string& msg);
+        LogLevel our_level = FromLspLevel(level);
+        if (async_log::Enabled(our_level)) {
+            async_log::Write(our_level, std::move(msg));
+        }
     }
 
     void log(Level level, const std::string& msg) override {
-        std::ignore = level;
-        std::cerr << msg << '\n';
-        std::cerr.flush();
+        LogLevel our_level = FromLspLevel(level);
+        if (async_log::Enabled(our_level)) {
+            async_log::Write(our_level, msg);
+        }
+    }
+
+private:
+    static LogLevel FromLspLevel(Level level) {
+        switch (level) {
+            case Level::SEVERE:  return LogLevel::kError;
+            case Level::WARNING: return LogLevel::kWarning;
+            case Level::INFO:    return LogLevel::kInfo;
+            default:             return LogLevel::kDebug;
+        }
     }
 };
 
@@ -0,0 +1,208 @@
+#include "lsp_driver.hpp"
+
+#include <cassert>
+#include <condition_variable>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+// LibLsp.
+#include "LibLsp/lsp/utils.h"
+
+#include "latency_stats.hpp"
+
+namespace fs = std::filesystem;
+
+LSPCompilationDriver::LSPCompilationDriver(
+  std::string main_module,
+  ModuleSearchPaths search_paths,
+  SourceOverlay overlay,
+  ModuleSourceCache* source_cache
+)
+  : MainModuleNameHolder{std::move(main_module)}
+  , CompilationDriver(main_module_name)
+  , search_paths_(std::move(search_paths))
+  , overlay_(std::move(overlay))
+  , source_cache_(source_cache) {
+    assert(source_cache_ != nullptr);
+}
+
+// TODO: every module is lexed, parsed and typed again by each driver,
+//   the standard library on every edit too. Modules and their types are
+//   owned by the driver and by the compiler globals, both in etude. Reuse
+//   needs a way there to keep processed modules (by name and content hash,
+//   with the hashes of their imports) and to adopt them into a new driver
+//   instead of ParseAllModules, ProcessModule and InferTypes.
+void LSPCompilationDriver::PrepareForTooling(const CancellationToken* cancel_token) {
+  {
+    ETUDE_TIMED_SCOPE("compile.parse_all_modules");
+    ParseAllModules();
+  }
+  ThrowIfCancelled(cancel_token);
+
+  {
+    ETUDE_TIMED_SCOPE("compile.register_symbols");
+    RegisterSymbols();
+  }
+  ThrowIfCancelled(cancel_token);
+
+  // Those in the beginning have the least dependencies (see TopSort(...))
+  for (size_t i = 0; i < modules_.size(); i += 1) {
+    {
+      ETUDE_TIMED_SCOPE("compile.process_module");
+      ProcessModule(modules_[i].get());
+    }
+    ThrowIfCancelled(cancel_token);
+  }
+
+  for (auto& m : modules_) {
+    {
+      ETUDE_TIMED_SCOPE("compile.infer_types");
+      m->InferTypes(solver_);
+    }
+    ThrowIfCancelled(cancel_token);
+  }
+
+  if (test_build) {
+    FMT_ASSERT(modules_.back()->GetName() == main_module_,
+                "Last module should be the main one");
+    return;
+  }
+}
+
+void LSPCompilationDriver::RunVisitor(Visitor* visitor) {
+  // Модуль, который был основным, находится в конце списка модулей
+  //   после тополнической сортировки. Т.к. в него все ребра входили,
+  //   но никакие не выходили: если кто-то его импортирует, мы об этом
+  //   не знаем.
+
+  modules_.back()->RunTooling(visitor);
+}
+
+namespace {
+
+struct CompilerGlobals {
+  std::mutex mutex;
+  std::condition_variable released;
+
+  bool held = false;
+  size_t interactive_waiting = 0;
+
+  // Of the background holder, null for an interactive one.
+  CancellationToken* preempt = nullptr;
+};
+
+CompilerGlobals& GetCompilerGlobals() {
+  static CompilerGlobals globals;
+  return globals;
+}
+
+}  // namespace
+
+CompilerLock& CompilerLock::operator=(CompilerLock&& other) noexcept {
+  if (this != &other) {
+    Release();
+    owned_ = std::exchange(other.owned_, false);
+  }
+  return *this;
+}
+
+CompilerLock::~CompilerLock() {
+  Release();
+}
+
+void CompilerLock::Release() {
+  if (!owned_) {
+    return;
+  }
+  owned_ = false;
+
+  CompilerGlobals& globals = GetCompilerGlobals();
+  {
+    std::lock_guard<std::mutex> lock(globals.mutex);
+    globals.held = false;
+    globals.preempt = nullptr;
+  }
+  globals.released.notify_all();
+}
+
+CompilerLock LSPCompilationDriver::LockCompilerGlobals(CompilePriority priority, CancellationToken* preempt) {
+  CompilerGlobals& globals = GetCompilerGlobals();
+  std::unique_lock<std::mutex> lock(globals.mutex);
+
+  if (priority == CompilePriority::kInteractive) {
+    globals.interactive_waiting += 1;
+    if (globals.held && globals.preempt != nullptr) {
+      globals.preempt->Cancel();
+    }
+
+    globals.released.wait(lock, [&] { return !globals.held; });
+
+    globals.interactive_waiting -= 1;
+    globals.preempt = nullptr;
+  } else {
+    globals.released.wait(lock, [&] { return !globals.held && globals.interactive_waiting == 0; });
+    globals.preempt = preempt;
+  }
+
+  globals.held = true;
+
+  CompilerLock compiler_lock;
+  compiler_lock.owned_ = true;
+  return compiler_lock;
+}
+
+lex::InputFile LSPCompilationDriver::OpenFile(std::string_view name) {
+  ETUDE_TIMED_SCOPE("compile.open_file");
+
+  auto file_name = std::string(name) + ".et";
+
+  std::vector<const fs::path*> dirs;
+  dirs.push_back(&search_paths_.root);
+  for (const fs::path& include_path: search_paths_.include_paths) {
+    dirs.push_back(&include_path);
+  }
+  if (!search_paths_.stdlib.empty()) {
+    dirs.push_back(&search_paths_.stdlib);
+  }
+
+  for (const fs::path* dir: dirs) {
+    // Also forcing lowercase on windows. Because default fs there (ntfs)
+    //   is not case-sensitive.
+    // TODO: check vscode extension works on windows.
+    std::string abs_path = lsp::NormalizePath((*dir / file_name).string(), false);
+
+    std::optional<ModuleSource> source;
+
+    auto it = overlay_.find(abs_path);
+    if (it != overlay_.end()) {
+      source = it->second;
+    } else {
+      source = source_cache_->Load(abs_path);
+    }
+
+    if (!source.has_value()) {
+      // Shadows the module found later, once it's there.
+      opened_modules_.push_back(OpenedModule{
+        path: abs_path,
+        hash: std::nullopt,
+      });
+      continue;
+    }
+
+    opened_modules_.push_back(OpenedModule{
+      path: abs_path,
+      hash: source->hash,
+    });
+    return lex::InputFile{std::stringstream(*source->text), std::move(abs_path)};
+  }
+
+  // The compiler would look for it relative to the cwd of the server,
+  //   that's some other project's module, if any.
+  std::string tried;
+  for (const fs::path* dir: dirs) {
+    tried += fmt::format("\n  {}", dir->string());
+  }
+  throw std::runtime_error(fmt::format("Module {} not found, looked in:{}", name, tried));
+}
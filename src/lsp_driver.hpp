@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Etude compiler.
+#include "driver/compil_driver.hpp"
+#include "driver/module.hpp"
+
+#include "cancellation.hpp"
+#include "module_cache.hpp"
+
+// Where modules are searched for, in this order. Previously the compiler
+//   searched the working directory and we changed it before every
+//   compilation, which is process-wide. Now every driver knows its paths.
+struct ModuleSearchPaths {
+  // Directory of the main module.
+  std::filesystem::path root;
+
+  std::vector<std::filesystem::path> include_paths;
+
+  // Empty, if there is no standard library.
+  std::filesystem::path stdlib;
+};
+
+// Who is waiting for a compilation, decides who gets the compiler first.
+enum class CompilePriority : uint8_t {
+  // Somebody is waiting for the result: the file being edited, a query.
+  kInteractive,
+  // Open files kept fresh in advance. Gives way to interactive work.
+  kBackground,
+};
+
+// Compiler globals held, see LSPCompilationDriver::LockCompilerGlobals.
+class CompilerLock {
+public:
+  CompilerLock() = default;
+
+  CompilerLock(CompilerLock&& other) noexcept
+    : owned_(std::exchange(other.owned_, false)) {}
+
+  CompilerLock& operator=(CompilerLock&& other) noexcept;
+
+  CompilerLock(const CompilerLock&) = delete;
+  CompilerLock& operator=(const CompilerLock&) = delete;
+
+  ~CompilerLock();
+
+  bool owns_lock() const {
+    return owned_;
+  }
+
+private:
+  friend class LSPCompilationDriver;
+
+  void Release();
+
+  bool owned_ = false;
+};
+
+// CompilationDriver keeps the main module name as std::string_view, while
+//   the driver outlives the function that compiled. So the name is owned
+//   here, in a base initialized before CompilationDriver.
+struct MainModuleNameHolder {
+  std::string main_module_name;
+};
+
+class LSPCompilationDriver final : private MainModuleNameHolder, public CompilationDriver {
+public:
+  // Modules on disk are read through source_cache, so that the standard
+  //   library isn't read from disk on each compilation.
+  LSPCompilationDriver(
+    std::string main_module,
+    ModuleSearchPaths search_paths,
+    SourceOverlay overlay,
+    ModuleSourceCache* source_cache
+  );
+
+  // Throws CompilationCancelled between modules, if the token is cancelled.
+  void PrepareForTooling(const CancellationToken* cancel_token = nullptr);
+
+  void RunVisitor(Visitor* visitor);
+
+  // The compiler still has global state (type storage, for example), which
+  //   isn't owned by a driver. Hold this lock while a driver runs, other
+  //   work of the server (edits, queries) doesn't need it.
+  //
+  // Interactive work gets the lock before any background work waiting
+  //   for it. If background work holds it, its preempt token is cancelled
+  //   when interactive work starts waiting: the driver stops at the next
+  //   module boundary (see PrepareForTooling) and gives the lock up.
+  static CompilerLock LockCompilerGlobals(
+    CompilePriority priority = CompilePriority::kInteractive,
+    CancellationToken* preempt = nullptr
+  );
+
+  // Every module opened so far, including the main one, and every place
+  //   a module was looked for and not found. After ParseAllModules that's
+  //   the whole import graph.
+  const std::vector<OpenedModule>& OpenedModules() const {
+    return opened_modules_;
+  }
+
+private:
+  virtual lex::InputFile OpenFile(std::string_view name) override;
+
+  ModuleSearchPaths search_paths_;
+  SourceOverlay overlay_;
+  ModuleSourceCache* source_cache_;
+
+  std::vector<OpenedModule> opened_modules_;
+};
@@ -24,9 +24,7 @@ void LSPVisitor::VisitReturn(ReturnStatement* node) {
 }
 
 void LSPVisitor::VisitAssignment(AssignmentStatement* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitAssignment called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitAssignment called.");
 
   node->target_->Accept(this);
   node->value_->Accept(this);
@@ -39,6 +37,8 @@ void LSPVisitor::VisitExprStatement(ExprStatement* node) {
 // Declarations
 
 void LSPVisitor::VisitTypeDecl(TypeDeclStatement* node) {
+  ThrowIfCancelled(cancel_token_);
+
   usages_->push_back(SymbolUsage{
     range: LsRangeFromLexToken(node->name_),
     decl_def: {
@@ -47,19 +47,49 @@ void LSPVisitor::VisitTypeDecl(TypeDeclStatement* node) {
     },
   });
 
-  symbols_->push_back(lsDocumentSymbol{
+  lsDocumentSymbol symbol{
     name: std::string(node->name_.GetName()),
     kind: lsSymbolKind::TypeAlias,
     range: LsRangeFromLexToken(node->name_),
     selectionRange: LsRangeFromLexToken(node->name_),
-  });
+  };
+
+  // Members of structs and sums are in the outline under the type.
+  types::Type* body = node->body_;
+  std::vector<types::Member>* members = nullptr;
+  if (body != nullptr && body->tag == types::TypeTag::TY_STRUCT) {
+    symbol.kind = lsSymbolKind::Struct;
+    members = &body->as_struct.first;
+  } else if (body != nullptr && body->tag == types::TypeTag::TY_SUM) {
+    symbol.kind = lsSymbolKind::Enum;
+    members = &body->as_sum.first;
+  }
+
+  if (members != nullptr) {
+    symbol.children.emplace();
+    for (const types::Member& member: *members) {
+      lsRange member_range = LsRangeFromLexToken(member.name);
+      symbol.children->push_back(lsDocumentSymbol{
+        name: std::string(member.field),
+        kind: symbol.kind == lsSymbolKind::Struct ? lsSymbolKind::Field : lsSymbolKind::EnumMember,
+        range: member_range,
+        selectionRange: member_range,
+      });
+
+      // Range of the type covers its members.
+      const lsPosition& end = symbol.range.end;
+      if (member_range.end.line > end.line || (member_range.end.line == end.line && member_range.end.character > end.character)) {
+        symbol.range.end = member_range.end;
+      }
+    }
+  }
+
+  symbols_->push_back(std::move(symbol));
 }
 
 
 void LSPVisitor::VisitVarDecl(VarDeclStatement* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitVarDecl called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitVarDecl called.");
 
   assert(node->value_ != nullptr);
   node->value_->Accept(this);
@@ -77,20 +107,28 @@ void LSPVisitor::VisitVarDecl(VarDeclStatement* node) {
       decl_position: node->lvalue_->name_.location,
       def_position: node->lvalue_->name_.location,
     },
-    type_name: node->value_->GetType()->Format(),
+    type: node->value_->GetType(),
   });
 }
 
 void LSPVisitor::VisitFunDecl(FunDeclStatement* node) {
+  ThrowIfCancelled(cancel_token_);
+
   if (node->body_) {
     // TODO: store fun token inside of fun decl, include it into the symbol.
     symbols_->push_back(lsDocumentSymbol{
       name: std::string(node->name_.GetName()),
-      kind: lsSymbolKind::Variable,
+      kind: lsSymbolKind::Function,
       range: lsRange(LsRangeFromLexToken(node->name_).start, LsPositionFromLexLocation(node->body_->GetLocation())),
       selectionRange: LsRangeFromLexToken(node->name_),
+      children: std::vector<lsDocumentSymbol>(),
     });
 
+    // Parameters and locals go under the function. Nothing is added to
+    //   the outer list until we're back, so the pointer stays valid.
+    std::vector<lsDocumentSymbol>* outer_symbols = symbols_;
+    symbols_ = &symbols_->back().children.value();
+
     for (auto& param : node->formals_) {
       symbols_->push_back(lsDocumentSymbol{
         name: std::string(param.GetName()),
@@ -109,11 +147,13 @@ void LSPVisitor::VisitFunDecl(FunDeclStatement* node) {
     }
 
     node->body_->Accept(this);
+
+    symbols_ = outer_symbols;
   } else {
       // TODO: store fun token inside of fun decl, include it into the symbol.
     symbols_->push_back(lsDocumentSymbol{
       name: std::string(node->name_.GetName()),
-      kind: lsSymbolKind::Variable,
+      kind: lsSymbolKind::Function,
       range: LsRangeFromLexToken(node->name_),
       selectionRange: LsRangeFromLexToken(node->name_),
     });
@@ -152,9 +192,7 @@ void LSPVisitor::VisitFunDecl(FunDeclStatement* node) {
 //   даже нет определения, потому по факту в AST его не будет.
 
 void LSPVisitor::VisitBindingPat(BindingPattern* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitBindingPat called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitBindingPat called.");
 
   // Все то же самое, как в variable decl. Ситуация похожая:
   //   добавился символ и все.
@@ -172,36 +210,28 @@ void LSPVisitor::VisitBindingPat(BindingPattern* node) {
       decl_position: node->name_.location,
       def_position: node->name_.location,
     },
-    type_name: node->type_->Format(),
+    type: node->type_,
   });
 }
 
 void LSPVisitor::VisitDiscardingPat(DiscardingPattern* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitDiscardingPat called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitDiscardingPat called.");
 
   // Ничего делать не надо, символов не добавилось.
 }
 
 void LSPVisitor::VisitLiteralPat(LiteralPattern* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitLiteralPat called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitLiteralPat called.");
 
   // Ничего делать не надо, литерал не добавляет символы.
 }
 
 void LSPVisitor::VisitStructPat(StructPattern* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitStructPat called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitStructPat called.");
 }
 
 void LSPVisitor::VisitVariantPat(VariantPattern* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitVariantPat called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitVariantPat called.");
 
   // Необходимо зайти внутрь, там может быть еще variant pattern или binding pattern.
   //   Возможно, какие-то еще образцы. Если есть, конечно.
@@ -227,7 +257,7 @@ void LSPVisitor::VisitVariantPat(VariantPattern* node) {
           decl_position: member.name.location,
           def_position: member.name.location,
         },
-        type_name: type->Format(),
+        type: type,
       });
     }
   }
@@ -244,26 +274,20 @@ void LSPVisitor::VisitComparison(ComparisonExpression* node) {
 
 
 void LSPVisitor::VisitBinary(BinaryExpression* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitBinary called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitBinary called.");
 
   node->left_->Accept(this);
   node->right_->Accept(this);
 }
 
 void LSPVisitor::VisitUnary(UnaryExpression* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitUnary called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitUnary called.");
 
   node->operand_->Accept(this);
 }
 
 void LSPVisitor::VisitDeref(DereferenceExpression* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitDeref called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitDeref called.");
 
   node->operand_->Accept(this);
 }
@@ -302,9 +326,7 @@ void LSPVisitor::VisitNew(NewExpression* node) {
 
 
 void LSPVisitor::VisitMatch(MatchExpression* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitMatch called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitMatch called.");
 
   node->against_->Accept(this);
 
@@ -331,9 +353,7 @@ void LSPVisitor::VisitFnCall(FnCallExpression* node) {
     arg->Accept(this);
   }
 
-  #if TRACE_VISITOR
-    fmt::println(stderr, "FnCall(.fn_name_ = {}, .callable = {})", node->fn_name_, reinterpret_cast<void*>(node->callable_));
-  #endif
+  ETUDE_TRACE(kVisitor, "FnCall(.fn_name_ = {}, .callable = {})", node->fn_name_, reinterpret_cast<void*>(node->callable_));
 }
 
 // В нашем случае, полная копия VisitFnCall.
@@ -346,9 +366,7 @@ void LSPVisitor::VisitIntrinsic(IntrinsicCall* node) {
 }
 
 void LSPVisitor::VisitCompoundInitalizer(CompoundInitializerExpr* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitCompoundInitalizer called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitCompoundInitalizer called.");
 
   types::Type* type = TypeStorage(node->GetType());
 
@@ -358,9 +376,7 @@ void LSPVisitor::VisitCompoundInitalizer(CompoundInitializerExpr* node) {
   } else if (type->tag == types::TypeTag::TY_SUM) {
     members = &type->as_sum.first;
   } else {
-    #if TRACE_VISITOR
-      fmt::println(stderr, "DEBUG: LSPVisitor::VisitCompoundInitalizer haven't found members to compound initialize..");
-    #endif
+    ETUDE_TRACE(kVisitor, "DEBUG: LSPVisitor::VisitCompoundInitalizer haven't found members to compound initialize..");
   }
 
   for (CompoundInitializerExpr::Member& initializer: node->initializers_) {
@@ -373,7 +389,7 @@ void LSPVisitor::VisitCompoundInitalizer(CompoundInitializerExpr* node) {
               decl_position: member.name.location,
               def_position: member.name.location,
             },
-            type_name: member.ty->Format(),
+            type: member.ty,
           });
 
           break;
@@ -391,9 +407,7 @@ void LSPVisitor::VisitCompoundInitalizer(CompoundInitializerExpr* node) {
 
 
 void LSPVisitor::VisitFieldAccess(FieldAccessExpression* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitFieldAccess called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitFieldAccess called.");
 
   node->struct_expression_->Accept(this);
 
@@ -408,7 +422,7 @@ void LSPVisitor::VisitFieldAccess(FieldAccessExpression* node) {
           decl_position: member.name.location,
           def_position: member.name.location,
         },
-        type_name: node->GetType()->Format(),
+        type: node->GetType(),
       });
 
       break;
@@ -417,9 +431,7 @@ void LSPVisitor::VisitFieldAccess(FieldAccessExpression* node) {
 }
 
 void LSPVisitor::VisitVarAccess(VarAccessExpression* node) {
-  #if TRACE_VISITOR
-    fmt::println(stderr, "TRACE: LSPVisitor::VisitVarAccess called.");
-  #endif
+  ETUDE_TRACE(kVisitor, "LSPVisitor::VisitVarAccess called.");
 
   assert(node->layer_ != nullptr && "context builder is expected to have finished it's job");
   ast::scope::Symbol* symbol = node->layer_->FindDeclForUsage(
@@ -433,16 +445,11 @@ void LSPVisitor::VisitVarAccess(VarAccessExpression* node) {
         decl_position: symbol->declared_at.position,
         def_position: symbol->declared_at.position,
       },
-       type_name: symbol->GetType()->Format(),
+      type: symbol->GetType(),
     });
   }
 
-  symbols_->push_back(lsDocumentSymbol{
-    name: std::string(node->name_.GetName()),
-    kind: lsSymbolKind::Variable,
-    range: LsRangeFromLexToken(node->name_),
-    selectionRange: LsRangeFromLexToken(node->name_),
-  });
+  // An access is not a symbol, the declaration is already in the outline.
 }
 
 void LSPVisitor::VisitLiteral(LiteralExpression* node) {
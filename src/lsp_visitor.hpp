@@ -16,6 +16,9 @@
 #include "driver/compil_driver.hpp"
 #include "driver/module.hpp"
 
+#include "async_log.hpp"
+#include "cancellation.hpp"
+
 struct SymbolDeclDefInfo {
   // Function, type or variable was imported, if it is from another module.
   //   But then it was declared in that module we import it from
@@ -32,7 +35,9 @@ struct SymbolUsage {
 
   SymbolDeclDefInfo decl_def;
 
-  std::optional<std::string> type_name;
+  // Formatted at the end of the compilation, see TypeNames. Owned by
+  //   the driver, which produced the usage.
+  types::Type* type = nullptr;
 
   bool is_decl = false;
   bool is_def = false;
@@ -70,11 +75,9 @@ inline lsRange LsRangeFromLexToken(const lex::Token& token) {
   lsPosition start = end;
   start.character -= static_cast<int>(token.length());
 
-  #if TRACE_VISITOR
-    // Useful in combination with visit functions logging.
-    //   Makes a clue what location is considered by the visitor at the moment.
-    fmt::println(stderr, "TokenToLSRange: TokenToLsRange ({}, {})-({}, {})", start.line, start.character, end.line, end.character);
-  #endif
+  // Useful in combination with visit functions logging.
+  //   Makes a clue what location is considered by the visitor at the moment.
+  ETUDE_TRACE(kVisitor, "TokenToLSRange: TokenToLsRange ({}, {})-({}, {})", start.line, start.character, end.line, end.character);
 
   // Exclusive like range in editor.
   // https://microsoft.github.io/language-server-protocol/specifications/lsp/3.17/specification/#range
@@ -86,10 +89,12 @@ class LSPVisitor: public Visitor {
 public:
   LSPVisitor(
     std::vector<lsDocumentSymbol>* symbols,
-    std::vector<SymbolUsage>* usages
+    std::vector<SymbolUsage>* usages,
+    const CancellationToken* cancel_token = nullptr
   )
     : symbols_(symbols)
-    , usages_(usages) {
+    , usages_(usages)
+    , cancel_token_(cancel_token) {
       assert(symbols_ != nullptr);
   }
 
@@ -148,4 +153,7 @@ public:
 private:
   std::vector<lsDocumentSymbol>* symbols_;
   std::vector<SymbolUsage>* usages_;
+
+  // Checked between top-level declarations.
+  const CancellationToken* cancel_token_;
 };
@@ -0,0 +1,29 @@
+#include "memory_budget.hpp"
+
+#include <algorithm>
+
+std::vector<std::string> ChooseEvictions(std::vector<FileMemory> files, size_t budget_bytes, const std::string& keep) {
+  size_t total = 0;
+  for (const FileMemory& file: files) {
+    total += file.bytes;
+  }
+
+  std::sort(files.begin(), files.end(), [](const FileMemory& lhs, const FileMemory& rhs) {
+    return lhs.last_used < rhs.last_used;
+  });
+
+  std::vector<std::string> evictions;
+  for (FileMemory& file: files) {
+    if (total <= budget_bytes) {
+      break;
+    }
+    if (file.path == keep || file.bytes == 0) {
+      continue;
+    }
+
+    total -= file.bytes;
+    evictions.push_back(std::move(file.path));
+  }
+
+  return evictions;
+}
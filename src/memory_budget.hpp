@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Compiled state of open files (drivers with their ASTs and type storage,
+//   indexes of usages) is what takes memory in the server, texts are
+//   small next to it. With a budget, state of the least recently used
+//   files is dropped, leaving only their text and diagnostic, and
+//   compiled again when somebody asks for them. Until then a change of
+//   an import only refreshes the diagnostic.
+
+// Compiled state of a file is estimated by what its driver has read:
+//   compiled modules take about this much per byte of their source.
+//   Heap of the whole process can't tell files apart, other threads
+//   allocate while a file is compiled.
+//
+// Not measured yet, 32 is a guess. To calibrate, run compile_bench with
+//   ETUDE_STDLIB set to the real standard library: heap_per_source_byte
+//   is peak heap of a compilation over the source bytes it has read.
+//   Take the largest one of the benchmarks, peak is above what stays,
+//   so the budget errs on the safe side. Until then the server takes
+//   ETUDE_LSP_BYTES_PER_SOURCE_BYTE.
+inline constexpr size_t kCompiledBytesPerSourceByte = 32;
+
+// Compiled state of an open file, as the budget sees it.
+struct FileMemory {
+  std::string path;
+  size_t bytes = 0;
+  // Larger is more recent, see SnapshotRegistry::LastUsed.
+  uint64_t last_used = 0;
+};
+
+// Files to drop compiled state of, least recently used first, until
+//   the rest fits into the budget. The file in use right now (keep) is
+//   never chosen, even if it doesn't fit alone.
+std::vector<std::string> ChooseEvictions(std::vector<FileMemory> files, size_t budget_bytes, const std::string& keep);
@@ -0,0 +1,70 @@
+#include "module_cache.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#include <utility>
+
+#include "content_hash.hpp"
+
+namespace fs = std::filesystem;
+
+std::optional<ModuleSource> ModuleSourceCache::Load(const std::string& abs_path) {
+  std::error_code error;
+  fs::file_time_type mtime = fs::last_write_time(abs_path, error);
+  uintmax_t size = error ? 0 : fs::file_size(abs_path, error);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (error) {
+    entries_.erase(abs_path);
+    return std::nullopt;
+  }
+
+  auto it = entries_.find(abs_path);
+  if (it != entries_.end() && it->second.mtime == mtime && it->second.size == size) {
+    return it->second.source;
+  }
+
+  std::ifstream file(abs_path, std::ios::binary);
+  if (!file) {
+    entries_.erase(abs_path);
+    return std::nullopt;
+  }
+  auto content = std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  uint64_t hash = HashContent(content);
+
+  ModuleSource source{
+    text: std::make_shared<const std::string>(std::move(content)),
+    hash: hash,
+  };
+
+  entries_[abs_path] = Entry{
+    mtime: mtime,
+    size: size,
+    source: source,
+  };
+
+  return source;
+}
+
+bool ModuleSourceCache::Unchanged(const std::vector<OpenedModule>& modules, const SourceOverlay& overlay) {
+  if (modules.empty()) {
+    return false;
+  }
+
+  for (const OpenedModule& module: modules) {
+    std::optional<uint64_t> hash;
+    if (auto it = overlay.find(module.path); it != overlay.end()) {
+      hash = it->second.hash;
+    } else if (std::optional<ModuleSource> source = Load(module.path)) {
+      hash = source->hash;
+    }
+
+    if (hash != module.hash) {
+      return false;
+    }
+  }
+
+  return true;
+}
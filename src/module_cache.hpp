@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Text of a module with its hash. Shared between compilations, never
+//   modified.
+struct ModuleSource {
+  std::shared_ptr<const std::string> text;
+  uint64_t hash = 0;
+};
+
+// Texts of files opened in the editor, by normalized absolute path. They
+//   take priority over what is on disk, user may not have saved them yet.
+using SourceOverlay = std::unordered_map<std::string, ModuleSource>;
+
+// A place some compilation has looked for a module at, and what exactly
+//   it has read there. Search paths are tried in order: every place tried
+//   before the module was found, or all of them, if it wasn't, is recorded
+//   as missing. A file appearing there changes what the compilation reads
+//   as much as an edit of the module does.
+struct OpenedModule {
+  std::string path;
+  // Nothing, if there was no such file.
+  std::optional<uint64_t> hash;
+};
+
+// Modules on disk (the standard library, imports not opened in the editor),
+//   read once and shared by all compilations. An entry is read again only
+//   if the file's modification time or size changed.
+class ModuleSourceCache {
+public:
+  // Nothing, if there is no such file.
+  std::optional<ModuleSource> Load(const std::string& abs_path);
+
+  // Whether every module is still what it was, and every missing one is
+  //   still missing, looking at the overlay first, then at the disk. False
+  //   for an empty list: nothing is known.
+  bool Unchanged(const std::vector<OpenedModule>& modules, const SourceOverlay& overlay);
+
+private:
+  struct Entry {
+    std::filesystem::file_time_type mtime;
+    uintmax_t size = 0;
+    ModuleSource source;
+  };
+
+  std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+};
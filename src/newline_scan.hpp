@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Поиск переводов строк по 16 байт за раз. Без SSE2 используем memchr,
+//   в glibc и msvcrt он и так векторизован (выбирается под процессор
+//   при загрузке).
+
+namespace newline_scan {
+
+#if defined(__SSE2__)
+inline uint32_t NewlineMask(const char* block) {
+  __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+  __m128i eq = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'));
+  return static_cast<uint32_t>(_mm_movemask_epi8(eq));
+}
+#endif
+
+// Appends offsets of all line feeds in text, each plus base.
+template <typename Offset>
+void FindNewlines(std::string_view text, std::vector<Offset>& out, size_t base = 0) {
+  size_t pos = 0;
+
+  #if defined(__SSE2__)
+    for (; pos + 16 <= text.size(); pos += 16) {
+      uint32_t mask = NewlineMask(text.data() + pos);
+      while (mask != 0) {
+        out.push_back(static_cast<Offset>(base + pos + static_cast<size_t>(__builtin_ctz(mask))));
+        mask &= mask - 1;
+      }
+    }
+    for (; pos < text.size(); ++pos) {
+      if (text[pos] == '\n') {
+        out.push_back(static_cast<Offset>(base + pos));
+      }
+    }
+  #else
+    while (pos < text.size()) {
+      const void* found = std::memchr(text.data() + pos, '\n', text.size() - pos);
+      if (found == nullptr) {
+        break;
+      }
+      pos = static_cast<size_t>(static_cast<const char*>(found) - text.data());
+      out.push_back(static_cast<Offset>(base + pos));
+      pos += 1;
+    }
+  #endif
+}
+
+} // namespace newline_scan
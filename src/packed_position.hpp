@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// LibLsp.
+#include "LibLsp/lsp/lsRange.h"
+
+// Line in the upper 32 bits, column in the lower ones. Packed positions
+//   compare the same way as positions do, so a sorted column of them is
+//   searched with a single comparison per step.
+inline uint64_t PackPosition(uint64_t line, uint64_t column) {
+  assert(line <= UINT32_MAX && column <= UINT32_MAX);
+  return (line << 32) | column;
+}
+
+inline uint64_t PackPosition(const lsPosition& position) {
+  assert(position.line >= 0 && position.character >= 0);
+  return PackPosition(static_cast<uint64_t>(position.line), static_cast<uint64_t>(position.character));
+}
+
+inline uint32_t PackedLine(uint64_t packed) {
+  return static_cast<uint32_t>(packed >> 32);
+}
+
+inline uint32_t PackedColumn(uint64_t packed) {
+  return static_cast<uint32_t>(packed);
+}
+
+inline lsPosition UnpackPosition(uint64_t packed) {
+  return lsPosition{static_cast<int>(PackedLine(packed)), static_cast<int>(PackedColumn(packed))};
+}
+
+// Where positions move, when the text in a range is replaced. Positions
+//   before the range stay, positions after it move with the text.
+class PositionShift {
+public:
+  // Characters are counted as bytes, like EditedFile does.
+  PositionShift(const lsRange& replaced, std::string_view text)
+    : start_(PackPosition(replaced.start))
+    , old_end_(PackPosition(replaced.end)) {
+      size_t last_newline = text.rfind('\n');
+      if (last_newline == std::string_view::npos) {
+        new_end_ = PackPosition(PackedLine(start_), PackedColumn(start_) + text.size());
+      } else {
+        uint64_t newlines = std::count(text.begin(), text.end(), '\n');
+        new_end_ = PackPosition(PackedLine(start_) + newlines, text.size() - last_newline - 1);
+      }
+  }
+
+  uint64_t Start() const {
+    return start_;
+  }
+
+  uint64_t OldEnd() const {
+    return old_end_;
+  }
+
+  uint64_t NewEnd() const {
+    return new_end_;
+  }
+
+  // Whether [first, last] shares at least a point with the replaced
+  //   range. A token ending right where the text is inserted touches
+  //   it: typing continues the token.
+  bool Touches(uint64_t first, uint64_t last) const {
+    return first <= old_end_ && start_ <= last;
+  }
+
+  // Positions inside of the replaced range go to the end of the new text.
+  uint64_t Map(uint64_t packed) const {
+    if (packed < start_) {
+      return packed;
+    }
+
+    if (packed <= old_end_) {
+      return new_end_;
+    }
+
+    if (PackedLine(packed) == PackedLine(old_end_)) {
+      return PackPosition(PackedLine(new_end_), PackedColumn(new_end_) + (PackedColumn(packed) - PackedColumn(old_end_)));
+    }
+
+    // Column stays, line moves by the difference. Wraps around, if there
+    //   are less lines now, and that's exactly the subtraction needed.
+    return packed + ((uint64_t{PackedLine(new_end_)} - PackedLine(old_end_)) << 32);
+  }
+
+  // Position, which Map moves to packed. Nothing for the new text up to
+  //   its end: only positions the edit touches go there.
+  std::optional<uint64_t> Unmap(uint64_t packed) const {
+    if (packed < start_) {
+      return packed;
+    }
+
+    if (packed <= new_end_) {
+      return std::nullopt;
+    }
+
+    if (PackedLine(packed) == PackedLine(new_end_)) {
+      return PackPosition(PackedLine(old_end_), PackedColumn(old_end_) + (PackedColumn(packed) - PackedColumn(new_end_)));
+    }
+
+    return packed - ((uint64_t{PackedLine(new_end_)} - PackedLine(old_end_)) << 32);
+  }
+
+private:
+  uint64_t start_;
+  uint64_t old_end_;
+  uint64_t new_end_;
+};
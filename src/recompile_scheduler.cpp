@@ -0,0 +1,108 @@
+#include "recompile_scheduler.hpp"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+RecompileScheduler::RecompileScheduler(std::chrono::milliseconds quiet_period, CompileFn compile)
+  : quiet_period_(quiet_period)
+  , compile_(std::move(compile))
+  , worker_([this] { Run(); }) {}
+
+RecompileScheduler::~RecompileScheduler() {
+  Stop();
+}
+
+void RecompileScheduler::Schedule(const std::string& path, uint64_t version) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_[path] = Pending{
+      version: version,
+      deadline: Clock::now() + quiet_period_,
+    };
+  }
+  wakeup_.notify_one();
+}
+
+bool RecompileScheduler::Cancel(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pending_.erase(path) != 0;
+}
+
+void RecompileScheduler::Supersede(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_token_ != nullptr && running_path_ == path) {
+    running_token_->Cancel();
+  }
+}
+
+void RecompileScheduler::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    stopping_ = true;
+    pending_.clear();
+
+    if (running_token_ != nullptr) {
+      running_token_->Cancel();
+    }
+  }
+  wakeup_.notify_one();
+
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+void RecompileScheduler::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (!stopping_) {
+    if (pending_.empty()) {
+      wakeup_.wait(lock);
+      continue;
+    }
+
+    Clock::time_point nearest = Clock::time_point::max();
+    for (const auto& [_, pending]: pending_) {
+      nearest = std::min(nearest, pending.deadline);
+    }
+
+    if (Clock::now() < nearest) {
+      // Schedule() could have moved the deadline further, then we'll just
+      //   wake up and wait again.
+      wakeup_.wait_until(lock, nearest);
+      continue;
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> due;
+    Clock::time_point now = Clock::now();
+    for (auto it = pending_.begin(); it != pending_.end();) {
+      if (it->second.deadline <= now) {
+        due.emplace_back(it->first, it->second.version);
+        it = pending_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    for (const auto& [path, version]: due) {
+      if (stopping_) {
+        break;
+      }
+
+      auto token = std::make_shared<CancellationToken>();
+      running_path_ = path;
+      running_token_ = token;
+
+      lock.unlock();
+      compile_(path, version, *token);
+      lock.lock();
+
+      running_path_.clear();
+      running_token_.reset();
+    }
+  }
+}
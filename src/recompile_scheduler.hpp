@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "cancellation.hpp"
+
+// Delays recompilation of a file until it wasn't edited for a quiet period.
+//   A burst of didChange notifications (somebody is typing) becomes a single
+//   compilation of the latest version. Older versions, which haven't started
+//   compiling yet, are never compiled.
+//
+// Compilation runs on the scheduler's own thread. The callback is called
+//   without the scheduler lock held, so it may take locks of the server.
+//   It gets a token, which is cancelled, if the file is edited while
+//   the compilation is still running.
+class RecompileScheduler {
+public:
+  using Clock = std::chrono::steady_clock;
+  using CompileFn = std::function<void(const std::string& path, uint64_t version, const CancellationToken& token)>;
+
+  RecompileScheduler(std::chrono::milliseconds quiet_period, CompileFn compile);
+  ~RecompileScheduler();
+
+  RecompileScheduler(const RecompileScheduler&) = delete;
+  RecompileScheduler& operator=(const RecompileScheduler&) = delete;
+
+  // Replaces the pending compilation of the file, if any, and restarts
+  //   the quiet period.
+  void Schedule(const std::string& path, uint64_t version);
+
+  // Forgets the pending compilation. Returns whether there was one, then
+  //   the caller is expected to compile by itself (someone needs results
+  //   right now).
+  bool Cancel(const std::string& path);
+
+  // Cancels the compilation of the file, if it is running now. Call it
+  //   before waiting for locks the compilation holds, the result is
+  //   going to be thrown away anyway.
+  void Supersede(const std::string& path);
+
+  void Stop();
+
+  std::chrono::milliseconds QuietPeriod() const {
+    return quiet_period_;
+  }
+
+private:
+  struct Pending {
+    uint64_t version = 0;
+    Clock::time_point deadline;
+  };
+
+  void Run();
+
+  const std::chrono::milliseconds quiet_period_;
+  const CompileFn compile_;
+
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  std::unordered_map<std::string, Pending> pending_;
+  bool stopping_ = false;
+
+  std::string running_path_;
+  std::shared_ptr<CancellationToken> running_token_;
+
+  // Last member, is started after everything else is initialized.
+  std::thread worker_;
+};
@@ -1,13 +1,18 @@
+#include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
 #include <iterator>
 #include <filesystem>
 #include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <variant>
 #include <sstream>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
 
 // LibLsp.
@@ -39,8 +44,26 @@
 #include "driver/compil_driver.hpp"
 #include "driver/module.hpp"
 
+#include "arrival_order.hpp"
+#include "async_log.hpp"
+#include "background_recompiler.hpp"
+#include "cancellation.hpp"
+#include "compile_cache.hpp"
+#include "dependency_graph.hpp"
+#include "edited_file.hpp"
+#include "file_snapshot.hpp"
+#include "latency_stats.hpp"
 #include "logger.hpp"
+#include "lsp_driver.hpp"
 #include "lsp_visitor.hpp"
+#include "memory_budget.hpp"
+#include "recompile_scheduler.hpp"
+#include "session_recording.hpp"
+#include "session_replay.hpp"
+#include "stats_request.hpp"
+#include "symbol_table.hpp"
+#include "trace_events.hpp"
+#include "usage_index.hpp"
 
 // Needed for _setmode.
 #if defined(_WIN32)
@@ -50,162 +73,103 @@
 
 namespace fs = std::filesystem;
 
-#define TRACE_CONTENT_HOLDER 1
-#define TRACE_INVALIDATION 1
-
-struct EditedFile {
-  std::string content;
-  std::vector<size_t> line_starts;
-
-  // line is [line_starts[i], line_starts[i + 1] or file size, if eof is the boundary) bytes. That means
-  //   it includes line feed, bacause lines are adjacent, without gaps. Lines end with '\n', except the
-  //   last one (which could end with '\n', but not necessarily).
-  //   We could consider lines as text separated by '\n', but then we'd either store ends
-  //   as well or compute ends by subtracting one from the next line start, which seems
-  //   hacky.
-  // The last line does not necessarily end with a '\n'. If so, end-of-file ends active
-  //   line, without producing any more of them. This is handled by the fact that
-  //   we add new lines upon '\n', but only if a new line will actually start. So
-  //   if the last line ends with '\n', we won't start a new line as a special case.
-
-  void set_content(std::string new_content) {
-    content = std::move(new_content);
-    line_starts.clear();
-    line_starts.push_back(0); // Первая строка начинается с первого байта.
-    find_line_starts(0);
-
-    #if TRACE_CONTENT_HOLDER
-      fmt::println(stderr, "content.size() = {}", content.size());
-      fmt::print(stderr, "line_starts = [");
-      for (const auto& item: line_starts) {
-        fmt::print(stderr, "{},", item);
-      }
-      fmt::println(stderr, "]");
-    #endif
-  }
-
-  static size_t length(size_t start, size_t end) {
-    return end - start;
+// Search paths for every compilation, root is replaced by directory of
+//   the compiled file. Filled in main.
+ModuleSearchPaths default_search_paths;
+
+// Texts of all open files. Must be called with file_cache_mutex held.
+SourceOverlay SnapshotOpenFiles();
+
+// Modules each open file imported during its last compilation. Guarded
+//   by file_cache_mutex.
+DependencyGraph dependency_graph;
+
+// Modules on disk, shared by all compilations. Has its own lock.
+ModuleSourceCache module_sources;
+
+// Recent compilations of open files. Has its own lock.
+CompileCache compile_cache(&module_sources);
+
+// What queries read, published by ViewedFile. Has its own lock, queries
+//   don't take file_cache_mutex.
+SnapshotRegistry snapshots;
+
+// ContentModified, lsErrorCodes of LspCpp don't have it.
+constexpr int32_t kContentModified = -32801;
+
+// Answer to an outdated query. The client drops both, but a cancelled
+//   request must not look answered, and a query for an old text must
+//   not look like there's nothing at the position.
+Rsp_Error OutdatedError(const ArrivalOrder::Query& query) {
+  Rsp_Error error;
+  if (query.Reason() == ArrivalOrder::Outdating::kCancelRequest) {
+    error.error.code = lsErrorCodes::RequestCancelled;
+    error.error.message = "Request is cancelled";
+  } else {
+    error.error.code = static_cast<lsErrorCodes>(kContentModified);
+    error.error.message = "Document has changed since the request";
   }
+  return error;
+}
 
-  void update_content(lsRange range, std::string replacement) {
-    assert(range.start.line < line_starts.size());
-    assert(range.end.line < line_starts.size());
-
-    #if TRACE_CONTENT_HOLDER
-      fmt::println(stderr, "content.size() = {}", content.size());
-      fmt::print(stderr, "line_starts = [");
-      for (const auto& item: line_starts) {
-        fmt::print(stderr, "{},", item);
-      }
-      fmt::println(stderr, "]");
-
-      fmt::println(
-        stderr,
-        "range.start.line = {}, range.end.line = {}, line_starts.size() = {}",
-        range.start.line,
-        range.end.line,
-        line_starts.size()
-      );
-    #endif
-    
-    size_t edited_start = line_starts[range.start.line] + range.start.character;
-    size_t edited_end = line_starts[range.end.line] + range.end.character;
-
-    assert(edited_start < content.size());
-    assert(edited_end < content.size());
+// See kCompiledBytesPerSourceByte. Set in main.
+size_t compiled_bytes_per_source_byte = kCompiledBytesPerSourceByte;
 
-    if (length(edited_start, edited_end) < replacement.size()) {
-      // Чтобы не инвалидировать итераторы, расширим до их взятия.
-      size_t underflow = replacement.size() - length(edited_start, edited_end);
-      std::fill_n(std::back_inserter(content), underflow, '\0');
+// Compiled state of a file: its driver holds every module it has read,
+//   parsed and typed. Indexes are small next to that.
+size_t EstimateCompiledBytes(const std::vector<OpenedModule>& modules, const SourceOverlay& overlay) {
+  size_t source_bytes = 0;
+  for (const OpenedModule& module: modules) {
+    if (!module.hash.has_value()) {
+      continue;
     }
+    if (auto it = overlay.find(module.path); it != overlay.end()) {
+      source_bytes += it->second.text->size();
+    } else if (std::optional<ModuleSource> source = module_sources.Load(module.path)) {
+      source_bytes += source->text->size();
+    }
+  }
+  return source_bytes * compiled_bytes_per_source_byte;
+}
 
-    // Хотим перезаписать интервал новыми данными.
+// Everything compilation needs, copied out of the file. Compilation itself
+//   then runs without holding locks of the files.
+struct CompileInputs {
+  std::string module_name;
 
-    // Если интервал уменьшился, то переместим данные после него и сократим тем самым строку.
-    //   Данные интервала затем перезапишем новыми.
-    auto edited_start_it = content.begin() + edited_start;
-    auto edited_end_it   = content.begin() + edited_end;
-    #if TRACE_CONTENT_HOLDER
-      fmt::println(stderr, "length(edited_start, edited_end) = {}", length(edited_start, edited_end));
-    #endif
-    if (length(edited_start, edited_end) > replacement.size()) {
-      size_t excess = length(edited_start, edited_end) - replacement.size();
-      
-      // [ a | b c d e_1 e_2 e_3 | f g h i] -> [ a | b c d | f g h i]
-      // Сократим интервал.
-      std::move(edited_end_it, content.end(), edited_end_it - excess);
-
-      // Заменим данные.
-      std::move(replacement.begin(), replacement.end(), edited_start_it);
-
-      // Удаляем лишнее в конце, данные оттуда уже переместили.
-      content.erase(content.end() - excess, content.end());
-    } else if (length(edited_start, edited_end) < replacement.size()) {
-      // Интервал расширился. Место создали ранее, надо записать новое содержимое.
-      size_t underflow = replacement.size() - length(edited_start, edited_end);
-
-      std::move_backward(edited_end_it, content.end() - underflow, content.end());
-
-      // Заменим данные.
-      std::move(replacement.begin(), replacement.end(), edited_start_it);
-    } else {
-      std::move(replacement.begin(), replacement.end(), edited_start_it);
-    }
+  // Normalized, as in the overlay.
+  std::string file_path;
 
-    find_line_starts(range.start.line);
-  }
+  // Document and its version, for the timeline.
+  std::string uri;
+  uint64_t version = 0;
 
-  // Считая, что начала строк остались правильными до line_valid_until включительно
-  //  (всегда можно указать нулевую, первую в 1-индексации, строку, уж ее начало-то
-  //  правильное, она всегда с 0-го байта начинается), пересчитать начала строк.
-  void find_line_starts(size_t line_valid_until) {
-    size_t pos = line_starts[line_valid_until];
-    line_starts.erase(line_starts.begin() + line_valid_until + 1, line_starts.end());
+  ModuleSearchPaths search_paths;
+  SourceOverlay overlay;
 
-    for (; pos < content.size(); ++pos) {
-      if (content[pos] == '\n' && pos + 1 < content.size()) {
-        line_starts.push_back(pos + 1);
-      }
-    }
-  }
-};
+  // What the previous compilation has read. If all of it is the same,
+  //   compilation would produce the same result.
+  std::vector<OpenedModule> previous_modules;
 
-class LSPCompilationDriver final : public CompilationDriver {
-  using CompilationDriver::CompilationDriver;
+  // ViewedFile::stale_generation at the moment of copying.
+  uint64_t stale_generation = 0;
+};
 
-  virtual lex::InputFile OpenFile(std::string_view name) override;
+struct CompileResult {
+  // Inputs are the same as for the previous compilation, nothing else is
+  //   filled then. Previous results stay.
+  bool unchanged = false;
 
-public:
-  void PrepareForTooling() {
-    ParseAllModules();
-    RegisterSymbols();
+  uint64_t stale_generation = 0;
 
-    // Those in the beginning have the least dependencies (see TopSort(...))
-    for (size_t i = 0; i < modules_.size(); i += 1) {
-      ProcessModule(modules_[i].get());
-    }
+  std::optional<lsDiagnostic> diagnostic;
 
-    for (auto& m : modules_) {
-      m->InferTypes(solver_);
-    }
+  // Known even if compilation failed, up to the module that failed.
+  //   Empty, if even the driver couldn't be made.
+  std::vector<OpenedModule> modules;
 
-    if (test_build) {
-      FMT_ASSERT(modules_.back()->GetName() == main_module_,
-                  "Last module should be the main one");
-      return;
-    }
-  }
-  
-  void RunVisitor(Visitor* visitor) {
-    // Модуль, который был основным, находится в конце списка модулей
-    //   после тополнической сортировки. Т.к. в него все ребра входили,
-    //   но никакие не выходили: если кто-то его импортирует, мы об этом
-    //   не знаем.
-
-    modules_.back()->RunTooling(visitor);
-  }
+  // Missing, if compilation failed. Then the previous results are kept.
+  std::shared_ptr<const FileSnapshot> snapshot;
 };
 
 class ViewedFile {
@@ -216,7 +180,9 @@ public:
 
       std::ifstream file(abs_path_);
       auto content = std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
-      editor_content.set_content(content);
+      editor_content.set_content(std::move(content));
+
+      ETUDE_TRACE(kContentHolder, "size() = {}, line_count() = {}", editor_content.size(), editor_content.line_count());
 
       Recompile();
   }
@@ -224,139 +190,285 @@ public:
   ViewedFile(const ViewedFile& other) = delete;
   ViewedFile(ViewedFile&& other) = default;
 
-  void Recompile() {
-      // Компилятор на данный момент ищет файлы в рабочей директории.
-      //   В том числе, все импортируемые. Кроме стандартной библиотеки,
-      //   которую он найдет и так, если мы укажем переменную окружения.
-      //   Потому сменим рабочую директорию. Другие части нашего кода от
-      //   этого не зависят.
-
-      // Это и упрощение логики являются причинами однопоточного подхода.
-      //   Его производительности хватает, а сложности, которые он
-      //   создаст, в алгоритма и внутри компилятора (там есть 
-      //   глобальные переменные) перевешивают необходимость.
-
-      // https://stackoverflow.com/a/57096619
-      fs::current_path(abs_path_.parent_path());
-
-      std::string module_name = GetModuleName();
-      diagnostic.reset();
-
-      try {
-        // Важно, чтобы module_name существовал все время выполнения
-        //   этой функции, потому что compilation driver
-        //   принимает эту строку как std::string_view.
-        auto driver = std::make_unique<LSPCompilationDriver>(module_name);
-
-        driver->PrepareForTooling();
-
-        std::vector<lsDocumentSymbol> new_symbols;
-        std::vector<SymbolUsage> new_usages;
-        LSPVisitor visitor(&new_symbols, &new_usages);
-
-        driver->RunVisitor(&visitor);
-
-        last_driver = std::move(driver);
-        symbols = std::move(new_symbols);
-        usages = std::move(new_usages);
-      } catch (const ErrorAtLocation& err) {
-        diagnostic = lsDiagnostic{
-          range: lsRange{
-            LsPositionFromLexLocation(err.where()),
-            LsPositionFromLexLocation(err.where())
-          },
-          severity: lsDiagnosticSeverity::Error,
-          message: std::string(err.what()),
-        };
-        return;
-      } catch (const std::exception& exc) {
-        diagnostic = lsDiagnostic{
-          range: lsRange{lsPosition{0, 0}, lsPosition{0, 0}},
-          severity: lsDiagnosticSeverity::Error,
-          message: std::string(exc.what()),
-        };
-        return;
-      }
-  }
+  // Must be called with file_cache_mutex held.
+  CompileInputs MakeCompileInputs() const {
+    CompileInputs inputs{
+      module_name: GetModuleName(),
+      file_path: lsp::NormalizePath(abs_path_.string(), false),
+      uri: uri_.raw_uri_,
+      version: version,
+      search_paths: default_search_paths,
+      overlay: SnapshotOpenFiles(),
+      previous_modules: last_modules,
+      stale_generation: stale_generation,
+    };
+    inputs.search_paths.root = abs_path_.parent_path();
 
-  void RecompileOnLookup() {
-    recompile_on_lookup = true;
-  }
+    // The file may be not in the cache yet, if it's being opened.
+    inputs.overlay[inputs.file_path] = ModuleSource{
+      text: editor_content.snapshot(),
+      hash: editor_content.content_hash(),
+    };
 
-  void Lookup() {
-    if (recompile_on_lookup) {
-      Recompile();
-      recompile_on_lookup = false;
-    }
+    return inputs;
   }
 
-  // Delete information about symbols after position (there was
-  //   a change starting from this position). Symbols not touched
-  //   by modification are kept. With assumption that their accessible
-  //   scope symbols and definitions aren't changed by the modification.
-  //   Because it can only reference what is before, so it doesn't reference
-  //   anything modified.
-  void InvalidateAfterPosition(lsPosition position) {
-    #if TRACE_INVALIDATION
-      fmt::println(
-        stderr,
-        "Before InvalidateAfterPosition symbols.size() = {}, usages.size() = {}",
-        symbols.size(),
-        usages.size()
-    );
-    #endif
-    
-    std::erase_if(symbols, [&](const lsDocumentSymbol& symbol) {
-      const lsPosition& end = symbol.range.start;
-      return end.line > position.line || (end.line == position.line && end.character >= position.character);
-    });
+  // Doesn't touch any open file, so doesn't need file_cache_mutex. Only
+  //   one compilation runs at a time though, the compiler has globals.
+  //   Returns nothing, if the compilation was cancelled, or if it was
+  //   background one and gave the compiler up to interactive work (then
+  //   cancel_token isn't cancelled).
+  static std::optional<CompileResult> Compile(
+    CompileInputs inputs,
+    const CancellationToken* cancel_token,
+    CompilePriority priority = CompilePriority::kInteractive
+  ) {
+    ETUDE_TIMED_SCOPE("compile.total");
+    trace_events::Annotate(inputs.uri, inputs.version);
+
+    CompileResult result;
+    result.stale_generation = inputs.stale_generation;
+
+    // Compiler can't reuse modules between drivers: they are bound to
+    //   the driver, which parsed them (see PrepareForTooling). But if none
+    //   of the modules changed, and imports would be found at the same
+    //   places, there's nothing to do at all. Never so after an edit.
+    if (module_sources.Unchanged(inputs.previous_modules, inputs.overlay)) {
+      result.unchanged = true;
+      return result;
+    }
 
-    std::erase_if(usages, [&](const SymbolUsage& usage) {
-      const lsPosition& end = usage.range.end;
-      if (end.line > position.line || (end.line == position.line && end.character >= position.character)) {
-        return true;
+    // Or the same inputs were compiled before, not the last time.
+    uint64_t text_hash = inputs.overlay.at(inputs.file_path).hash;
+    if (std::optional<CachedCompilation> cached = compile_cache.Find(inputs.file_path, text_hash, inputs.overlay)) {
+      ETUDE_TIMED_SCOPE("compile.cache_hit");
+      result.diagnostic = std::move(cached->diagnostic);
+      result.modules = std::move(cached->modules);
+      if (cached->snapshot != nullptr) {
+        result.snapshot = cached->snapshot->WithVersion(inputs.version);
       }
+      return result;
+    }
 
-      lsPosition def_end = LsPositionFromLexLocation(usage.decl_def.def_position);
-      if (def_end.line > position.line || (def_end.line == position.line && def_end.character >= position.character)) {
-        return true;
+    // Cancelled by the caller, or by interactive work wanting the compiler.
+    CancellationToken preempt(cancel_token);
+
+    // Stays null, if even the driver couldn't be made.
+    std::unique_ptr<LSPCompilationDriver> driver;
+
+    try {
+      driver = std::make_unique<LSPCompilationDriver>(
+        std::move(inputs.module_name),
+        std::move(inputs.search_paths),
+        // Still needed, see EstimateCompiledBytes.
+        inputs.overlay,
+        &module_sources
+      );
+
+      CompilerLock compiler_lock;
+      if (priority == CompilePriority::kInteractive) {
+        // Other compilations are running meanwhile.
+        ETUDE_TIMED_SCOPE("compile.wait_for_compiler");
+        compiler_lock = LSPCompilationDriver::LockCompilerGlobals(priority, &preempt);
+      } else {
+        // Also waits for every interactive compilation.
+        ETUDE_TIMED_SCOPE("compile.wait_for_compiler.background");
+        compiler_lock = LSPCompilationDriver::LockCompilerGlobals(priority, &preempt);
       }
 
-      lsPosition decl_end = LsPositionFromLexLocation(usage.decl_def.decl_position);
-      if (decl_end.line > position.line || (decl_end.line == position.line && decl_end.character >= position.character)) {
-        return true;
+      driver->PrepareForTooling(&preempt);
+
+      SymbolTable symbol_table;
+      UsageIndex usage_index;
+      {
+        std::vector<lsDocumentSymbol> symbols;
+        std::vector<SymbolUsage> usages;
+        {
+          ETUDE_TIMED_SCOPE("compile.visitor");
+          LSPVisitor visitor(&symbols, &usages, &preempt);
+          driver->RunVisitor(&visitor);
+        }
+
+        ETUDE_TIMED_SCOPE("compile.build_indexes");
+        symbol_table = SymbolTable(symbols);
+        usage_index = UsageIndex(usages, inputs.file_path);
       }
 
-      return false;
-    });
+      // Still holding the compiler, queries won't need it.
+      TypeNames type_names;
+      {
+        ETUDE_TIMED_SCOPE("compile.format_types");
+        type_names = TypeNames(usage_index.Types());
+      }
 
-    #if TRACE_INVALIDATION
-      fmt::println(
-        stderr,
-        "After InvalidateAfterPosition symbols.size() = {}, usages.size() = {}",
-        symbols.size(),
-        usages.size()
+      // Of this driver alone. The heap of the process grows by what
+      //   other threads allocate meanwhile, too.
+      size_t memory_bytes = EstimateCompiledBytes(driver->OpenedModules(), inputs.overlay);
+
+      result.snapshot = std::make_shared<FileSnapshot>(
+        inputs.version,
+        std::nullopt,
+        std::move(driver),
+        std::move(symbol_table),
+        std::move(usage_index),
+        std::move(type_names),
+        memory_bytes
       );
-    #endif
-    
+    } catch (const CompilationCancelled&) {
+      // A newer version is going to be compiled, or this one again later.
+      return std::nullopt;
+    } catch (const ErrorAtLocation& err) {
+      result.diagnostic = lsDiagnostic{
+        range: lsRange{
+          LsPositionFromLexLocation(err.where()),
+          LsPositionFromLexLocation(err.where())
+        },
+        severity: lsDiagnosticSeverity::Error,
+        message: std::string(err.what()),
+      };
+    } catch (const std::exception& exc) {
+      result.diagnostic = lsDiagnostic{
+        range: lsRange{lsPosition{0, 0}, lsPosition{0, 0}},
+        severity: lsDiagnosticSeverity::Error,
+        message: std::string(exc.what()),
+      };
+    }
+
+    const LSPCompilationDriver* compiled = result.snapshot != nullptr ? result.snapshot->Driver() : driver.get();
+    if (compiled != nullptr) {
+      result.modules = compiled->OpenedModules();
+    }
+
+    // "Module not found" is answered from the cache only while the places
+    //   the driver has looked at are still empty, see OpenedModule.
+    if (!result.modules.empty()) {
+      compile_cache.Insert(inputs.file_path, text_hash, CachedCompilation{
+        modules: result.modules,
+        diagnostic: result.diagnostic,
+        snapshot: result.snapshot,
+      });
+    }
+
+    return result;
+  }
+
+  // Must be called with file_cache_mutex held.
+  void Publish(CompileResult result) {
+    // Nothing this file imports has changed since the inputs were taken.
+    if (result.stale_generation == stale_generation) {
+      recompile_on_lookup = false;
+    }
+
+    if (result.unchanged) {
+      return;
+    }
+
+    SetDependencies(result.modules);
+    last_modules = std::move(result.modules);
+
+    if (result.snapshot != nullptr) {
+      evicted = false;
+      SetSnapshot(std::move(result.snapshot));
+    } else {
+      SetSnapshot(snapshot->WithDiagnostic(version, std::move(result.diagnostic)));
+    }
+  }
+
+  // Must be called with file_cache_mutex held. For an evicted file,
+  //   compiled because something it imports has changed: its diagnostic
+  //   is kept fresh, compiled state stays dropped until a lookup or
+  //   an edit. The file stays stale for them.
+  void PublishDiagnostic(CompileResult result) {
+    assert(evicted);
+    if (result.unchanged) {
+      return;
+    }
+
+    SetDependencies(result.modules);
+    snapshot = std::make_shared<FileSnapshot>(version, std::move(result.diagnostic), nullptr, SymbolTable(), UsageIndex());
+    compile_cache.Remove(uri_.GetAbsolutePath().path);
+  }
+
+  // Previous results are kept, if the compilation is cancelled.
+  void Recompile(const CancellationToken* cancel_token = nullptr) {
+    if (auto result = Compile(MakeCompileInputs(), cancel_token)) {
+      Publish(std::move(*result));
+    }
+  }
+
+  // Drops the results of compilation to save memory, the text and
+  //   the diagnostic stay. Queries don't see the file until it's compiled
+  //   again: by the next lookup (see find_snapshot) or after an edit.
+  void EvictCompiledState() {
+    std::string path = uri_.GetAbsolutePath().path;
+
+    evicted = true;
+    snapshot = std::make_shared<FileSnapshot>(version, snapshot->Diagnostic(), nullptr, SymbolTable(), UsageIndex());
+    snapshots.Remove(path);
+    compile_cache.Remove(path);
+
+    // Otherwise the same inputs are "unchanged" and nothing is compiled.
+    last_modules.clear();
+    RecompileOnLookup();
+  }
+
+  void RecompileOnLookup() {
+    recompile_on_lookup = true;
+    stale_generation += 1;
+  }
+
+  // If the compilation is cancelled, the file stays stale until the next
+  //   lookup. Publish makes it fresh otherwise.
+  void Lookup(const CancellationToken* cancel_token = nullptr) {
+    if (recompile_on_lookup) {
+      Recompile(cancel_token);
+    }
+  }
+
+  // Results of the last compilation follow the text until the next one,
+  //   see FileSnapshot::WithEdits. All edits of a notification at once.
+  void ApplyEdits(const std::vector<PositionShift>& shifts) {
+    SetSnapshot(snapshot->WithEdits(version, shifts));
+
+    // Moved results aren't what compilation of the same inputs gives,
+    //   so it can't be skipped any more. Text, which has come back, is
+    //   still found in compile_cache.
+    last_modules.clear();
+  }
+
+  // Results are of the current text, which compiles: none of them were
+  //   moved along edits or dropped, or are left from before an error.
+  bool CompiledAsIs() const {
+    return snapshot->Driver() != nullptr && snapshot->CompiledVersion() == version && !snapshot->Diagnostic().has_value();
   }
 private:
-  std::string GetModuleName() {
+  std::string GetModuleName() const {
     // Module.et -> Module
     return abs_path_.filename().replace_extension().string();
   }
+
+  void SetDependencies(const std::vector<OpenedModule>& modules) {
+    std::vector<std::string> dependencies;
+    for (const OpenedModule& module: modules) {
+      dependencies.push_back(module.path);
+    }
+    dependency_graph.SetDependencies(uri_.GetAbsolutePath().path, std::move(dependencies));
+  }
+
+  void SetSnapshot(std::shared_ptr<const FileSnapshot> next) {
+    snapshot = std::move(next);
+    if (!evicted) {
+      snapshots.Publish(uri_.GetAbsolutePath().path, snapshot);
+    }
+  }
 public:
   lsDocumentUri uri_;
   fs::path abs_path_;
 
-  std::optional<lsDiagnostic> diagnostic;
-  std::vector<lsDocumentSymbol> symbols;
-  std::vector<SymbolUsage> usages;
-
-  // Last driver is stored for the module pointers to be up to date.
-  //   Otherwise module pointers are freed upon compilation driver
-  //   destruction.
-  std::unique_ptr<LSPCompilationDriver> last_driver;
+  // Results of the last compilation as of the current text, the same
+  //   one queries see. Holds the last driver, so that module pointers of
+  //   usages stay valid: they are freed with the driver.
+  std::shared_ptr<const FileSnapshot> snapshot = std::make_shared<FileSnapshot>();
 
   // Previosly we'd store std::string here with the full contents.
   //   But vscode doesn't tell the changed position, if we use
@@ -364,34 +476,46 @@ public:
   // 
   EditedFile editor_content;
 
+  // Incremented on each change of editor_content. Scheduled compilations
+  //   of older versions are skipped.
+  uint64_t version = 0;
+
+  // Modules the last compilation has read, with their hashes. Until
+  //   the text is edited.
+  std::vector<OpenedModule> last_modules;
+
   bool recompile_on_lookup = false;
+
+  // Incremented each time a module this file imports changes. Compilation
+  //   started before that doesn't make the file fresh.
+  uint64_t stale_generation = 0;
+
+  // Compiled state was dropped by the memory budget. Background
+  //   recompilations only refresh the diagnostic then (see
+  //   PublishDiagnostic), queries don't see the file.
+  bool evicted = false;
 };
 
 
 
+// Handlers run on the endpoint's workers, changes on the writer thread
+//   of ArrivalOrder, and compilations, delayed by RecompileScheduler, on
+//   the scheduler's thread. All of them take this lock before touching
+//   any open file. The scheduler doesn't hold it while compiling, see
+//   ViewedFile::Compile. Read-only queries don't take it at all, they
+//   read snapshots.
+std::mutex file_cache_mutex;
 std::unordered_map<std::string, ViewedFile> file_cache;
 
-lex::InputFile LSPCompilationDriver::OpenFile(std::string_view name) {
-  auto rel_path = std::string(name) + ".et";
-
-  // The file we're asked to open is always in cwd. We cd there before
-  //   opening, because etude compiler expect that (or it'll search
-  //   in stdlib, but we get absolute paths from language protocol
-  //   client anyway and then set module name to be just the filename
-  //   without .et).
-
-  // Also forcing lowercase on windows. Because default fs there (ntfs)
-  //   is not case-sensitive.
-  // TODO: check vscode extension works on windows.
-  std::string abs_path = lsp::NormalizePath(rel_path, false);
-  auto it = file_cache.find(abs_path);
-  if (it != file_cache.end()) {
-    auto& file = it->second;
-
-    return lex::InputFile{std::stringstream(file.editor_content.content), std::move(abs_path)};
-  } 
-  
-  return CompilationDriver::OpenFile(name);
+SourceOverlay SnapshotOpenFiles() {
+  SourceOverlay overlay;
+  for (const auto& [path, file]: file_cache) {
+    overlay.emplace(path, ModuleSource{
+      text: file.editor_content.snapshot(),
+      hash: file.editor_content.content_hash(),
+    });
+  }
+  return overlay;
 }
 
 int main(int argc, char** argv) {
@@ -400,6 +524,47 @@ int main(int argc, char** argv) {
     return -1;
   }
 
+  // Level of messages written to stderr and traces switched on, e.g.
+  //   ETUDE_LSP_LOG_LEVEL=debug ETUDE_LSP_TRACE=invalidation,visitor.
+  {
+    const char* log_level = std::getenv("ETUDE_LSP_LOG_LEVEL");
+    const char* traces = std::getenv("ETUDE_LSP_TRACE");
+    async_log::Configure(log_level != nullptr ? log_level : "", traces != nullptr ? traces : "");
+  }
+
+  // Value of "--name=value" or of the environment variable, the flag
+  //   wins. Empty, if there is neither.
+  auto option = [&](std::string_view name, const char* env_name) {
+    std::string value;
+    if (const char* env_value = std::getenv(env_name); env_value != nullptr) {
+      value = env_value;
+    }
+
+    for (int i = 1; i < argc; i += 1) {
+      std::string_view arg = argv[i] != nullptr ? argv[i] : "";
+      if (arg.starts_with("--") && arg.substr(2).starts_with(name) && arg.substr(2 + name.size()).starts_with("=")) {
+        value = arg.substr(2 + name.size() + 1);
+      }
+    }
+
+    return value;
+  };
+
+  auto has_flag = [&](std::string_view name) {
+    for (int i = 1; i < argc; i += 1) {
+      std::string_view arg = argv[i] != nullptr ? argv[i] : "";
+      if (arg.starts_with("--") && arg.substr(2) == name) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // Timeline for chrome://tracing or ui.perfetto.dev, written on exit.
+  if (std::string trace_file = option("trace-file", "ETUDE_LSP_TRACE_FILE"); !trace_file.empty()) {
+    trace_events::Start(std::move(trace_file));
+  }
+
   fs::path exec_path = fs::absolute(fs::path(argv[0]));
   fs::path exec_dir  = exec_path.parent_path();
   fs::path stdlib_path  = exec_dir / "etude_stdlib";
@@ -416,6 +581,27 @@ int main(int argc, char** argv) {
     setenv("ETUDE_STDLIB", stdlib_path.string().c_str(), true);
   #endif
 
+  // Variable is still set for the compiler, but modules are found by
+  //   the driver now. It doesn't depend on the working directory.
+  default_search_paths.stdlib = stdlib_path;
+
+  // Extra directories with modules, separated like in PATH.
+  if (const char* include_path = std::getenv("ETUDE_LSP_INCLUDE_PATH"); include_path != nullptr) {
+    #if defined(_WIN32)
+      constexpr char kPathListSeparator = ';';
+    #else
+      constexpr char kPathListSeparator = ':';
+    #endif
+
+    std::stringstream paths(include_path);
+    std::string path;
+    while (std::getline(paths, path, kPathListSeparator)) {
+      if (!path.empty()) {
+        default_search_paths.include_paths.push_back(fs::absolute(path));
+      }
+    }
+  }
+
   // From https://forums.codeguru.com/showthread.php?506745-stdin-stdout-as-binary-with-gcc:
   //   *nix doesn't see a difference between binary and non-binary I/O. What you may be
   //   running into is the difference between formatted and unformatted I/O. For unformatted
@@ -443,6 +629,66 @@ int main(int argc, char** argv) {
     }
   #endif
 
+  // Сколько ждать после последнего изменения перед компиляцией. Пока
+  //   пользователь печатает, компилировать каждую версию смысла нет.
+  std::chrono::milliseconds recompile_delay(150);
+  if (const char* delay_ms = std::getenv("ETUDE_LSP_RECOMPILE_DELAY_MS"); delay_ms != nullptr) {
+    recompile_delay = std::chrono::milliseconds(std::strtoul(delay_ms, nullptr, 10));
+  }
+
+  // Сколько памяти можно занять результатами компиляции открытых файлов,
+  //   в мегабайтах. Сверх этого они выбрасываются у давно не открывавшихся
+  //   файлов, текст остается. 0 или не задано: без ограничения.
+  size_t memory_budget_bytes = 0;
+  if (const char* budget_mb = std::getenv("ETUDE_LSP_MEMORY_BUDGET_MB"); budget_mb != nullptr) {
+    memory_budget_bytes = std::strtoull(budget_mb, nullptr, 10) << 20;
+  }
+
+  // Сколько байт памяти занимает скомпилированный модуль на байт его
+  //   текста, для бюджета. Меряется compile_bench (heap_per_source_byte).
+  if (const char* ratio = std::getenv("ETUDE_LSP_BYTES_PER_SOURCE_BYTE"); ratio != nullptr) {
+    compiled_bytes_per_source_byte = std::max<size_t>(std::strtoul(ratio, nullptr, 10), 1);
+  }
+
+  // Сколько последних компиляций помнить: отмена правки, переключение
+  //   ветки возвращают текст, который уже компилировался. 0 выключает.
+  if (const char* cache_size = std::getenv("ETUDE_LSP_COMPILE_CACHE_SIZE"); cache_size != nullptr) {
+    compile_cache.SetCapacity(std::strtoul(cache_size, nullptr, 10));
+  }
+
+  // Editing sessions are recorded with --record=<path> (or ETUDE_LSP_RECORD)
+  //   and played back without an editor with --replay=<path>, as fast as
+  //   possible or, with --replay-realtime, at the recorded pace. Replay
+  //   reports latency of requests to stderr on exit.
+  std::unique_ptr<RecordingStreamBuf> recording;
+  std::unique_ptr<std::istream> recorded_input;
+  std::unique_ptr<SessionReplay> replay;
+
+  if (std::string replay_file = option("replay", "ETUDE_LSP_REPLAY"); !replay_file.empty()) {
+    std::optional<std::vector<RecordedMessage>> messages = LoadRecording(replay_file);
+    if (!messages.has_value()) {
+      std::cerr << "Cannot read recorded session " << replay_file << std::endl;
+      return -1;
+    }
+
+    auto pace = has_flag("replay-realtime") ? SessionReplay::Pace::kRealTime : SessionReplay::Pace::kFast;
+    replay = std::make_unique<SessionReplay>(std::move(*messages), pace);
+  } else if (std::string record_file = option("record", "ETUDE_LSP_RECORD"); !record_file.empty()) {
+    recording = std::make_unique<RecordingStreamBuf>(std::cin.rdbuf(), record_file);
+    if (recording->is_open()) {
+      recorded_input = std::make_unique<std::istream>(recording.get());
+    } else {
+      std::cerr << "Cannot write recorded session to " << record_file << ", not recording" << std::endl;
+    }
+  }
+
+  std::istream& client_input = replay != nullptr ? replay->Input() : recorded_input != nullptr ? *recorded_input : std::cin;
+  std::ostream& client_output = replay != nullptr ? replay->Output() : std::cout;
+
+  // Outlives the endpoint, which reads from it.
+  ArrivalOrder arrival_order(client_input.rdbuf());
+  std::istream ordered_input(&arrival_order);
+
   std::atomic<bool> initialized = false;
   std::atomic<bool> exiting = false;
 
@@ -451,8 +697,12 @@ int main(int argc, char** argv) {
   auto server_endpoint = std::make_shared<GenericEndpoint>(logger);
   // TODO: handlers.
 
+  // Queries run in parallel, with each other and with changes. Changes
+  //   keep the order they were sent in, see ArrivalOrder.
+  auto endpoint_workers = static_cast<uint8_t>(std::clamp(std::thread::hardware_concurrency(), 2u, 8u));
+
   auto json_handler = std::make_shared<lsp::ProtocolJsonHandler>();
-  RemoteEndPoint client_endpoint(json_handler, server_endpoint, logger, lsp::Standard, 1);
+  RemoteEndPoint client_endpoint(json_handler, server_endpoint, logger, lsp::Standard, endpoint_workers);
 
   // https://github.com/kuafuwang/LspCpp/blob/e0b443d42e7d23638d727ac8ef6839b9e527bf0a/examples/StdIOServerExample.cpp#L57
   client_endpoint.registerHandler([&](const td_initialize::request& request) {
@@ -480,14 +730,15 @@ int main(int argc, char** argv) {
   auto update_diagnostics = [&](const ViewedFile& file) {
     Notify_TextDocumentPublishDiagnostics::notify notify;
     notify.params.uri = file.uri_;
-    if (file.diagnostic.has_value()) {
-      notify.params.diagnostics.push_back(file.diagnostic.value());
+    if (file.snapshot->Diagnostic().has_value()) {
+      notify.params.diagnostics.push_back(file.snapshot->Diagnostic().value());
     }
 
     client_endpoint.sendNotification(notify);
   };
 
-  auto find_file = [&](const lsDocumentUri& uri) -> ViewedFile& {
+  // Must be called with file_cache_mutex held.
+  auto get_file = [&](const lsDocumentUri& uri) -> ViewedFile& {
     auto file_it = file_cache.find(uri.GetAbsolutePath().path);
     if (file_it == file_cache.end()) {
       // Здесь произойдет разбор файла с путем doc_path.
@@ -526,21 +777,219 @@ int main(int argc, char** argv) {
       file_it = std::move(result.first);
     }
 
+    return file_it->second;
+  };
+
+  // Must be called with file_cache_mutex held. Over the budget, earlier
+  //   compilations kept for undo go first, then compiled state of
+  //   the least recently used files. Never of the file just used (keep).
+  auto enforce_memory_budget = [&](const std::string& keep) {
+    if (memory_budget_bytes == 0) {
+      return;
+    }
+
+    auto measure = [&] {
+      size_t total = 0;
+      std::vector<FileMemory> files;
+      for (const auto& [path, file]: file_cache) {
+        size_t bytes = file.snapshot->MemoryBytes() + compile_cache.BytesOf(path, file.snapshot->Driver());
+        total += bytes;
+        files.push_back(FileMemory{
+          path: path,
+          bytes: bytes,
+          last_used: snapshots.LastUsed(path),
+        });
+      }
+      return std::make_pair(total, std::move(files));
+    };
+
+    auto [total, files] = measure();
+    if (total <= memory_budget_bytes) {
+      return;
+    }
+
+    for (const auto& [path, file]: file_cache) {
+      compile_cache.Remove(path, file.snapshot->Driver());
+    }
+    std::tie(total, files) = measure();
+
+    for (const std::string& path: ChooseEvictions(std::move(files), memory_budget_bytes, keep)) {
+      ViewedFile& file = file_cache.at(path);
+      if (async_log::Enabled(LogLevel::kDebug)) {
+        async_log::Write(
+          LogLevel::kDebug,
+          fmt::format("memory budget: dropping compiled state of {} ({} KiB)", path, file.snapshot->MemoryBytes() / 1024)
+        );
+      }
+      file.EvictCompiledState();
+    }
+  };
+
+  // Must be called with file_cache_mutex held. Only files importing
+  //   the module (or looking for it, see OpenedModule) can be affected
+  //   by its change.
+  auto mark_importers_stale = [&](const std::string& path) {
+    for (const std::string& importer: dependency_graph.ImportersOf(path)) {
+      auto importer_it = file_cache.find(importer);
+      if (importer_it != file_cache.end()) {
+        importer_it->second.RecompileOnLookup();
+      }
+    }
+  };
+
+  // Recompiles open files, whose imports have changed, before they are
+  //   queried. Takes file_cache_mutex only to copy inputs and to publish.
+  //   Gives the compiler up to the file being edited and to queries.
+  //   One worker: compilations take turns for the compiler globals.
+  BackgroundRecompiler background_recompiler(
+    1,
+    [&](const std::string& path, const CancellationToken& token) {
+      CompileInputs inputs;
+      uint64_t version = 0;
+      {
+        std::lock_guard<std::mutex> lock(file_cache_mutex);
+
+        auto file_it = file_cache.find(path);
+        if (file_it == file_cache.end() || !file_it->second.recompile_on_lookup) {
+          // Closed, or someone already queried it.
+          return true;
+        }
+
+        version = file_it->second.version;
+        inputs = file_it->second.MakeCompileInputs();
+      }
+
+      std::optional<CompileResult> result = ViewedFile::Compile(std::move(inputs), &token, CompilePriority::kBackground);
+      if (!result.has_value()) {
+        // Unless the pass is cancelled, interactive work has taken
+        //   the compiler. Try again after it.
+        return token.IsCancelled();
+      }
+
+      std::lock_guard<std::mutex> lock(file_cache_mutex);
+
+      auto file_it = file_cache.find(path);
+      if (file_it == file_cache.end() || file_it->second.version != version) {
+        // Edited meanwhile, RecompileScheduler takes care of it.
+        return true;
+      }
+
+      ViewedFile& file = file_it->second;
+      if (file.evicted) {
+        // Nobody has asked for the file, its compiled state isn't worth
+        //   the memory. But its diagnostic is shown all the time.
+        file.PublishDiagnostic(std::move(*result));
+        update_diagnostics(file);
+        return true;
+      }
+      file.Publish(std::move(*result));
+      update_diagnostics(file);
+      enforce_memory_budget(path);
+      return true;
+    }
+  );
+
+  // Must be called with file_cache_mutex held.
+  auto recompile_importers = [&](const std::string& path) {
+    std::vector<BackgroundRecompiler::FileWithDependencies> stale;
+    for (const std::string& importer: dependency_graph.ImportersOf(path)) {
+      auto importer_it = file_cache.find(importer);
+      if (importer_it != file_cache.end() && importer_it->second.recompile_on_lookup) {
+        stale.emplace_back(importer, dependency_graph.DependenciesOf(importer));
+      }
+    }
+
+    if (!stale.empty()) {
+      background_recompiler.Start(std::move(stale));
+    }
+  };
+
+  RecompileScheduler recompile_scheduler(recompile_delay, [&](const std::string& path, uint64_t version, const CancellationToken& token) {
+    CompileInputs inputs;
+    {
+      std::lock_guard<std::mutex> lock(file_cache_mutex);
+
+      auto file_it = file_cache.find(path);
+      if (file_it == file_cache.end() || file_it->second.version != version) {
+        // Closed or changed again, then a newer version is scheduled.
+        return;
+      }
+
+      inputs = file_it->second.MakeCompileInputs();
+    }
+
+    // Edits and queries proceed while we compile.
+    std::optional<CompileResult> result = ViewedFile::Compile(std::move(inputs), &token);
+    if (!result.has_value()) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(file_cache_mutex);
+
+    auto file_it = file_cache.find(path);
+    if (file_it == file_cache.end() || file_it->second.version != version) {
+      return;
+    }
+
     ViewedFile& file = file_it->second;
+    file.Publish(std::move(*result));
+    update_diagnostics(file);
+    enforce_memory_budget(path);
+
+    // Typing has stopped, it's time for the files importing this one.
+    recompile_importers(path);
+  });
 
-    file.Lookup();
+  // Must be called with file_cache_mutex held.
+  auto find_file = [&](const lsDocumentUri& uri, const CancellationToken* cancel_token = nullptr) -> ViewedFile& {
+    ViewedFile& file = get_file(uri);
+    trace_events::Annotate(uri.raw_uri_, file.version);
+    snapshots.Touch(uri.GetAbsolutePath().path);
+
+    // Results are needed right now, don't wait for the quiet period.
+    if (recompile_scheduler.Cancel(uri.GetAbsolutePath().path)) {
+      file.RecompileOnLookup();
+    }
+
+    file.Lookup(cancel_token);
+    if (file.recompile_on_lookup) {
+      // Cancelled, it's the scheduler's again.
+      recompile_scheduler.Schedule(uri.GetAbsolutePath().path, file.version);
+    }
     update_diagnostics(file); // Cheap, can do on each request or notification.
+    enforce_memory_budget(uri.GetAbsolutePath().path);
 
     return file;
   };
 
+  // Queries read the latest snapshot: they don't wait for compilations
+  //   or for each other, and results of the last compilation follow
+  //   the edits until the next one. A file, which isn't open, is opened
+  //   (and compiled) first.
+  auto find_snapshot = [&](const lsDocumentUri& uri) -> std::shared_ptr<const FileSnapshot> {
+    std::shared_ptr<const FileSnapshot> snapshot = snapshots.Get(uri.GetAbsolutePath().path);
+    if (snapshot == nullptr) {
+      std::lock_guard<std::mutex> lock(file_cache_mutex);
+      snapshot = find_file(uri).snapshot;
+    }
+
+    trace_events::Annotate(uri.raw_uri_, snapshot->Version());
+    return snapshot;
+  };
+
   auto close_file = [&](const lsDocumentUri& uri) {
+    recompile_scheduler.Cancel(uri.GetAbsolutePath().path);
+    dependency_graph.Remove(uri.GetAbsolutePath().path);
     file_cache.erase(uri.GetAbsolutePath().path);
+    snapshots.Remove(uri.GetAbsolutePath().path);
+    // Each keeps a whole driver, and the memory budget only sees open files.
+    compile_cache.Remove(uri.GetAbsolutePath().path);
   };
 
-  client_endpoint.registerHandler([&](const td_symbol::request& request) {
-    auto& file_uri = request.params.textDocument.uri;
-    ViewedFile& file = find_file(file_uri);
+  client_endpoint.registerHandler([&](const td_symbol::request& request) -> lsp::ResponseOrError<td_symbol::response> {
+    ETUDE_TIMED_SCOPE("request.textDocument/documentSymbol");
+
+    ArrivalOrder::Query query = arrival_order.StartQuery(request.id);
 
     td_symbol::response response;
     response.id = request.id;
@@ -548,15 +997,26 @@ int main(int argc, char** argv) {
     if (!initialized) {
       return response;
     }
+    if (query.Outdated()) {
+      return OutdatedError(query);
+    }
 
-    response.result = file.symbols;
+    std::shared_ptr<const FileSnapshot> file = find_snapshot(request.params.textDocument.uri);
+    // A change is numbered, outdating the query, before it's applied. If
+    //   the snapshot is of a newer text, the query is outdated by now.
+    if (query.Outdated()) {
+      return OutdatedError(query);
+    }
+
+    response.result = file->Outline();
 
     return response;
   });
 
-  client_endpoint.registerHandler([&](const td_definition::request& request) {
-    auto& file_uri = request.params.textDocument.uri;
-    ViewedFile& file = find_file(file_uri);
+  client_endpoint.registerHandler([&](const td_definition::request& request) -> lsp::ResponseOrError<td_definition::response> {
+    ETUDE_TIMED_SCOPE("request.textDocument/definition");
+
+    ArrivalOrder::Query query = arrival_order.StartQuery(request.id);
 
     td_definition::response response;
     response.id = request.id;
@@ -564,44 +1024,34 @@ int main(int argc, char** argv) {
     if (!initialized) {
       return response;
     }
+    if (query.Outdated()) {
+      return OutdatedError(query);
+    }
 
-    SymbolUsage* usage = nullptr;
-    const lsPosition& editor_pos = request.params.position;
-    for (auto& usage_item: file.usages) {
-      // Токен не может продолжаться на следующей строке, перевод строки --
-      //   разделитель. Потому можно смотреть на строку начала.
-      if (usage_item.range.start.line != editor_pos.line) {
-        continue;
-      }
-
-      // Разрешаем равенство, т.к. можно встать сразу после символа,
-      //   это все еще разрешено. И после токена обычно пробельный символ,
-      //   потому все ок.
-      if (
-        usage_item.range.start.character <= editor_pos.character &&
-        editor_pos.character <= usage_item.range.end.character
-      ) {
-        assert(
-          usage == nullptr &&
-          "BUG: usages overlap (requested position is in both)."
-        );
-        usage = &usage_item;
-      }
+    std::shared_ptr<const FileSnapshot> file = find_snapshot(request.params.textDocument.uri);
+    // A change is numbered, outdating the query, before it's applied. If
+    //   the snapshot is of a newer text, the query is outdated by now.
+    if (query.Outdated()) {
+      return OutdatedError(query);
     }
 
+    std::optional<UsageIndex::UsageId> usage = file->Usages().Find(request.params.position);
+
     std::vector<LocationLink> locations; 
-    if (usage != nullptr) {
+    if (usage.has_value()) {
+      lex::Location decl_position = file->Usages().DeclPositionOf(file->Usages().DeclarationOf(*usage));
+
       // Distinguish decl and def positions like done in cquery:
       //    https://github.com/jacobdufault/cquery/blob/9b80917cbf7d26b78ec62b409442ecf96f72daf9/src/messages/text_document_definition.cc#L96
       locations.push_back(LocationLink {
-        targetUri: lsDocumentUri::FromPath(usage->decl_def.decl_position.unit->GetAbsPath().string()),
+        targetUri: lsDocumentUri::FromPath(decl_position.unit->GetAbsPath().string()),
         targetRange: lsRange{
-          LsPositionFromLexLocation(usage->decl_def.decl_position),
-          LsPositionFromLexLocation(usage->decl_def.decl_position),
+          LsPositionFromLexLocation(decl_position),
+          LsPositionFromLexLocation(decl_position),
         },
         targetSelectionRange: lsRange{
-          LsPositionFromLexLocation(usage->decl_def.decl_position),
-          LsPositionFromLexLocation(usage->decl_def.decl_position),
+          LsPositionFromLexLocation(decl_position),
+          LsPositionFromLexLocation(decl_position),
         },
       });
     }
@@ -611,9 +1061,10 @@ int main(int argc, char** argv) {
     return response;
   });
 
-  client_endpoint.registerHandler([&](const td_highlight::request& request) {
-    auto& file_uri = request.params.textDocument.uri;
-    ViewedFile& file = find_file(file_uri);
+  client_endpoint.registerHandler([&](const td_highlight::request& request) -> lsp::ResponseOrError<td_highlight::response> {
+    ETUDE_TIMED_SCOPE("request.textDocument/documentHighlight");
+
+    ArrivalOrder::Query query = arrival_order.StartQuery(request.id);
 
     td_highlight::response response;
     response.id = request.id;
@@ -621,37 +1072,23 @@ int main(int argc, char** argv) {
     if (!initialized) {
       return response;
     }
+    if (query.Outdated()) {
+      return OutdatedError(query);
+    }
 
-    SymbolUsage* usage = nullptr;
-    const lsPosition& editor_pos = request.params.position;
-    for (auto& usage_item: file.usages) {
-      // Токен не может продолжаться на следующей строке, перевод строки --
-      //   разделитель. Потому можно смотреть на строку начала.
-      if (usage_item.range.start.line != editor_pos.line) {
-        continue;
-      }
-
-      // Разрешаем равенство, т.к. можно встать сразу после символа,
-      //   это все еще разрешено. И после токена обычно пробельный символ,
-      //   потому все ок.
-      if (
-        usage_item.range.start.character <= editor_pos.character &&
-        editor_pos.character <= usage_item.range.end.character
-      ) {
-        assert(
-          usage == nullptr &&
-          "BUG: usages overlap (requested position is in both)."
-        );
-        usage = &usage_item;
-      }
+    std::shared_ptr<const FileSnapshot> file = find_snapshot(request.params.textDocument.uri);
+    // A change is numbered, outdating the query, before it's applied. If
+    //   the snapshot is of a newer text, the query is outdated by now.
+    if (query.Outdated()) {
+      return OutdatedError(query);
     }
 
+    std::optional<UsageIndex::UsageId> usage = file->Usages().Find(request.params.position);
+
     std::vector<lsDocumentHighlight> highlights; 
-    if (usage != nullptr) {
-      for (auto& usage_item: file.usages) {
-        if (usage_item.decl_def == usage->decl_def) {
-          highlights.push_back(lsDocumentHighlight{usage_item.range});          
-        }
+    if (usage.has_value()) {
+      for (UsageIndex::UsageId occurrence: file->Usages().OccurrencesOf(file->Usages().DeclarationOf(*usage))) {
+        highlights.push_back(lsDocumentHighlight{file->Usages().RangeOf(occurrence)});
       }
     }
 
@@ -660,9 +1097,10 @@ int main(int argc, char** argv) {
     return response;
   });
 
-  client_endpoint.registerHandler([&](const td_hover::request& request) {
-    auto& file_uri = request.params.textDocument.uri;
-    ViewedFile& file = find_file(file_uri);
+  client_endpoint.registerHandler([&](const td_hover::request& request) -> lsp::ResponseOrError<td_hover::response> {
+    ETUDE_TIMED_SCOPE("request.textDocument/hover");
+
+    ArrivalOrder::Query query = arrival_order.StartQuery(request.id);
 
     td_hover::response response;
     response.id = request.id;
@@ -670,42 +1108,32 @@ int main(int argc, char** argv) {
     if (!initialized) {
       return response;
     }
+    if (query.Outdated()) {
+      return OutdatedError(query);
+    }
 
-    SymbolUsage* usage = nullptr;
-    const lsPosition& editor_pos = request.params.position;
-    for (auto& usage_item: file.usages) {
-      // Токен не может продолжаться на следующей строке, перевод строки --
-      //   разделитель. Потому можно смотреть на строку начала.
-      if (usage_item.range.start.line != editor_pos.line) {
-        continue;
-      }
-
-      // Разрешаем равенство, т.к. можно встать сразу после символа,
-      //   это все еще разрешено. И после токена обычно пробельный символ,
-      //   потому все ок.
-      if (
-        usage_item.range.start.character <= editor_pos.character &&
-        editor_pos.character <= usage_item.range.end.character
-      ) {
-        assert(
-          usage == nullptr &&
-          "BUG: usages overlap (requested position is in both)."
-        );
-        usage = &usage_item;
-      }
+    std::shared_ptr<const FileSnapshot> file = find_snapshot(request.params.textDocument.uri);
+    // A change is numbered, outdating the query, before it's applied. If
+    //   the snapshot is of a newer text, the query is outdated by now.
+    if (query.Outdated()) {
+      return OutdatedError(query);
+    }
 
-      if (usage != nullptr && usage->type_name.has_value()) {
-        response.result.contents = {TextDocumentHover::Left{{{"of " + usage->type_name.value(), {}}}}, {}};
-        response.result.range = usage->range;
-      }
+    std::optional<UsageIndex::UsageId> usage = file->Usages().Find(request.params.position);
+    types::Type* type = usage.has_value() ? file->Usages().TypeOf(*usage) : nullptr;
+    if (type != nullptr) {
+      std::string type_name = file->TypeName(type);
+      response.result.contents = {TextDocumentHover::Left{{{"of " + type_name, {}}}}, {}};
+      response.result.range = file->Usages().RangeOf(*usage);
     }
 
     return response;
   });
 
-  client_endpoint.registerHandler([&](const td_prepareRename::request& request) {
-    auto& file_uri = request.params.textDocument.uri;
-    ViewedFile& file = find_file(file_uri);
+  client_endpoint.registerHandler([&](const td_prepareRename::request& request) -> lsp::ResponseOrError<td_prepareRename::response> {
+    ETUDE_TIMED_SCOPE("request.textDocument/prepareRename");
+
+    ArrivalOrder::Query query = arrival_order.StartQuery(request.id);
 
     td_prepareRename::response response;
     response.id = request.id;
@@ -713,64 +1141,64 @@ int main(int argc, char** argv) {
     if (!initialized) {
       return response;
     }
+    if (query.Outdated()) {
+      return OutdatedError(query);
+    }
+
+    std::lock_guard<std::mutex> lock(file_cache_mutex);
+
+    // Compilation, if the file needs one, stops once the request is
+    //   outdated. Then it's answered with an error.
+    ViewedFile& file = find_file(request.params.textDocument.uri, query.Token());
 
-    if (file.diagnostic.has_value()) {
+    // Occurrences an edit has touched since the last compilation are
+    //   dropped, renaming only the rest breaks the code. Compilation
+    //   of the scheduler may be running already, then find_file hasn't
+    //   waited for it.
+    if (!file.CompiledAsIs()) {
+      file.Recompile(query.Token());
+      update_diagnostics(file);
+    }
+    if (query.Outdated()) {
+      return OutdatedError(query);
+    }
+    if (!file.CompiledAsIs()) {
       // Should not allow to rename, if there's an error.
       //   Otherwise not all occurences may be renamed.
       //   Some of symbol usages may be deleted due to compilation
       //   error. Occurences may be among those symbol usages.
-      
       return response;
     }
+    const FileSnapshot& snapshot = *file.snapshot;
 
-    SymbolUsage* usage = nullptr;
-    const lsPosition& editor_pos = request.params.position;
-    for (auto& usage_item: file.usages) {
-      // Токен не может продолжаться на следующей строке, перевод строки --
-      //   разделитель. Потому можно смотреть на строку начала.
-      if (usage_item.range.start.line != editor_pos.line) {
-        continue;
-      }
-
-      // Разрешаем равенство, т.к. можно встать сразу после символа,
-      //   это все еще разрешено. И после токена обычно пробельный символ,
-      //   потому все ок.
-      if (
-        usage_item.range.start.character <= editor_pos.character &&
-        editor_pos.character <= usage_item.range.end.character
-      ) {
-        assert(
-          usage == nullptr &&
-          "BUG: usages overlap (requested position is in both)."
-        );
-        usage = &usage_item;
-      }
-    }
+    std::optional<UsageIndex::UsageId> usage = snapshot.Usages().Find(request.params.position);
 
-    if (usage == nullptr) {
+    if (!usage.has_value()) {
       return response;
     }
 
     EditedFile& content = file.editor_content;
-    const char* old_name = content.content.c_str() + content.line_starts[usage->range.start.line] + usage->range.start.character;
+    lsRange usage_range = snapshot.Usages().RangeOf(*usage);
 
     // There is no multiline tokens in Etude as of now.
-    size_t len = usage->range.end.character - usage->range.start.character + 1;
+    size_t len = usage_range.end.character - usage_range.start.character + 1;
+    std::string old_name = content.substr(content.offset_of(usage_range.start), len);
     
-    if (file.last_driver->GetModuleOf(std::string_view(old_name, len)) != nullptr) {
+    if (snapshot.Driver()->GetModuleOf(old_name) != nullptr) {
       // Cannot rename across modules for now! Need buildsystem integration to get all files to rename.
       return response;
     }
 
-    response.result.first = usage->range;
+    response.result.first = usage_range;
 
 
     return response;
   });
 
-  client_endpoint.registerHandler([&](const td_rename::request& request) {
-    auto& file_uri = request.params.textDocument.uri;
-    ViewedFile& file = find_file(file_uri);
+  client_endpoint.registerHandler([&](const td_rename::request& request) -> lsp::ResponseOrError<td_rename::response> {
+    ETUDE_TIMED_SCOPE("request.textDocument/rename");
+
+    ArrivalOrder::Query query = arrival_order.StartQuery(request.id);
 
     td_rename::response response;
     response.id = request.id;
@@ -778,115 +1206,187 @@ int main(int argc, char** argv) {
     if (!initialized) {
       return response;
     }
+    if (query.Outdated()) {
+      return OutdatedError(query);
+    }
 
-    SymbolUsage* usage = nullptr;
-    const lsPosition& editor_pos = request.params.position;
-    for (auto& usage_item: file.usages) {
-      // Токен не может продолжаться на следующей строке, перевод строки --
-      //   разделитель. Потому можно смотреть на строку начала.
-      if (usage_item.range.start.line != editor_pos.line) {
-        continue;
-      }
+    std::lock_guard<std::mutex> lock(file_cache_mutex);
 
-      // Разрешаем равенство, т.к. можно встать сразу после символа,
-      //   это все еще разрешено. И после токена обычно пробельный символ,
-      //   потому все ок.
-      if (
-        usage_item.range.start.character <= editor_pos.character &&
-        editor_pos.character <= usage_item.range.end.character
-      ) {
-        assert(
-          usage == nullptr &&
-          "BUG: usages overlap (requested position is in both)."
-        );
-        usage = &usage_item;
-      }
+    // Compilation, if the file needs one, stops once the request is
+    //   outdated. Then it's answered with an error.
+    ViewedFile& file = find_file(request.params.textDocument.uri, query.Token());
+
+    // Occurrences an edit has touched since the last compilation are
+    //   dropped, renaming only the rest breaks the code. Compilation
+    //   of the scheduler may be running already, then find_file hasn't
+    //   waited for it.
+    if (!file.CompiledAsIs()) {
+      file.Recompile(query.Token());
+      update_diagnostics(file);
+    }
+    if (query.Outdated()) {
+      return OutdatedError(query);
+    }
+    if (!file.CompiledAsIs()) {
+      // Current text doesn't compile.
+      return response;
     }
+    const FileSnapshot& snapshot = *file.snapshot;
+
+    std::optional<UsageIndex::UsageId> usage = snapshot.Usages().Find(request.params.position);
 
-    if (usage == nullptr) {
+    if (!usage.has_value()) {
       return response;
     }
 
     EditedFile& content = file.editor_content;
-    const char* old_name = content.content.c_str() + content.line_starts[usage->range.start.line] + usage->range.start.character;
+    lsRange usage_range = snapshot.Usages().RangeOf(*usage);
 
     // There is no multiline tokens in Etude as of now.
-    size_t len = usage->range.end.character - usage->range.start.character + 1;
+    size_t len = usage_range.end.character - usage_range.start.character + 1;
+    std::string old_name = content.substr(content.offset_of(usage_range.start), len);
     
-    if (file.last_driver->GetModuleOf(std::string_view(old_name, len)) != nullptr) {
+    if (snapshot.Driver()->GetModuleOf(old_name) != nullptr) {
       // Cannot rename across modules for now! Need buildsystem integration to get all files to rename.
       return response;
     }
 
     response.result.changes = decltype(response.result.changes)::value_type();
 
-    for (auto& usage_item: file.usages) {
-      // Токен не может продолжаться на следующей строке, перевод строки --
-      //   разделитель. Потому можно смотреть на строку начала.
-      if (usage_item.decl_def != usage->decl_def) {
-        continue;
-      }
+    auto& edits = response.result.changes.value()[request.params.textDocument.uri.raw_uri_];
+    for (UsageIndex::UsageId occurrence: snapshot.Usages().OccurrencesOf(snapshot.Usages().DeclarationOf(*usage))) {
+      edits.push_back(lsTextEdit{snapshot.Usages().RangeOf(occurrence), request.params.newName});
+    }
 
-      auto uri = request.params.textDocument.uri.raw_uri_;
 
-      response.result.changes.value()[uri].push_back(lsTextEdit{usage_item.range, request.params.newName});
+    return response;
+  });
+
+  // Doesn't touch files, so no file_cache_mutex.
+  client_endpoint.registerHandler([&](const etude_stats::request& request) {
+    auto to_ms = [](std::chrono::nanoseconds duration) {
+      return std::chrono::duration<double, std::milli>(duration).count();
+    };
+
+    etude_stats::response response;
+    response.id = request.id;
+
+    for (const LatencySummary& summary: latency_stats::Summarize()) {
+      response.result.push_back(EtudeLatencyStats{
+        name: summary.name,
+        count: summary.count,
+        mean_ms: to_ms(summary.mean),
+        p50_ms: to_ms(summary.p50),
+        p90_ms: to_ms(summary.p90),
+        p99_ms: to_ms(summary.p99),
+        max_ms: to_ms(summary.max),
+      });
     }
 
+    if (request.params.reset) {
+      latency_stats::ResetAll();
+    }
 
     return response;
   });
 
+  // Changes are applied by the writer thread of arrival_order, one at
+  //   a time and in the order they were sent. Handlers only hand them over.
   client_endpoint.registerHandler([&](Notify_InitializedNotification::notify& notify) {
-    initialized.store(true);
+    arrival_order.Apply([&] {
+      initialized.store(true);
+    }, "initialized");
   });
 
   client_endpoint.registerHandler([&](Notify_Exit::notify& notify) {
     client_endpoint.stop();
     exiting.store(true);
+    exiting.notify_all();
   });
 
   client_endpoint.registerHandler([&](Notify_TextDocumentDidOpen::notify& notify) {
-    if (!initialized) {
-        return;
-    }
-    
-    auto& file_uri = notify.params.textDocument.uri;
-    ViewedFile& file = find_file(file_uri);
+    std::string uri = notify.params.textDocument.uri.raw_uri_;
+    std::optional<int64_t> version = notify.params.textDocument.version;
+
+    arrival_order.Apply([&, notify = std::move(notify)] {
+      ETUDE_TIMED_SCOPE("notification.textDocument/didOpen");
 
-    logger.log(lsp::Log::Level::INFO, "opened file with uri " + notify.params.textDocument.uri.raw_uri_);
+      if (!initialized) {
+          return;
+      }
+
+      const lsDocumentUri& file_uri = notify.params.textDocument.uri;
+
+      std::lock_guard<std::mutex> lock(file_cache_mutex);
+
+      ViewedFile& file = find_file(file_uri);
+
+      // Importers may have missed the module until now, or have found
+      //   another one further along the search paths.
+      mark_importers_stale(file_uri.GetAbsolutePath().path);
+      recompile_importers(file_uri.GetAbsolutePath().path);
+
+      logger.log(lsp::Log::Level::INFO, "opened file with uri " + notify.params.textDocument.uri.raw_uri_);
+    }, "textDocument/didOpen", uri, version);
   });
 
 
   client_endpoint.registerHandler([&](Notify_TextDocumentDidChange::notify& notify) {
-    if (!initialized) {
+    std::string uri = notify.params.textDocument.uri.raw_uri_;
+    std::optional<int64_t> version = notify.params.textDocument.version;
+
+    // Compilation of the previous version may be running right now.
+    //   Ask it to stop, its result is outdated anyway. Even before
+    //   the change is applied, earlier ones may take a while.
+    recompile_scheduler.Supersede(notify.params.textDocument.uri.GetAbsolutePath().path);
+    background_recompiler.CancelAll();
+
+    arrival_order.Apply([&, notify = std::move(notify)] {
+      ETUDE_TIMED_SCOPE("notification.textDocument/didChange");
+
+      if (!initialized) {
+          return;
+      }
+
+      const lsDocumentUri& file_uri = notify.params.textDocument.uri;
+
+      if (notify.params.contentChanges.empty()) {
+        logger.warning("didChange event without contentChanges for file " + file_uri.GetAbsolutePath().path);
         return;
-    }
+      }
 
-    if (notify.params.contentChanges.empty()) {
-      logger.warning("didChange event without contentChanges for file " + notify.params.textDocument.uri.GetAbsolutePath().path);
-      return;      
-    }
+      std::lock_guard<std::mutex> lock(file_cache_mutex);
 
-    auto& file_uri = notify.params.textDocument.uri;
-    ViewedFile& target_file = find_file(file_uri);
+      ViewedFile& target_file = get_file(file_uri);
 
-    for (const lsTextDocumentContentChangeEvent& event: notify.params.contentChanges) {
-      assert(event.range.has_value()); // Значение отсутствует только для обновлений в формате "весь файл сразу".
-      target_file.editor_content.update_content(event.range.value(), event.text);
-      target_file.InvalidateAfterPosition(event.range->end);
-    }
+      std::vector<PositionShift> shifts;
+      for (const lsTextDocumentContentChangeEvent& event: notify.params.contentChanges) {
+        assert(event.range.has_value()); // Значение отсутствует только для обновлений в формате "весь файл сразу".
+        target_file.editor_content.update_content(event.range.value(), event.text);
 
-    target_file.Recompile();
-    update_diagnostics(target_file);
+        ETUDE_TRACE(
+          kContentHolder,
+          "range = ({}, {})-({}, {}), size() = {}, line_count() = {}",
+          event.range->start.line,
+          event.range->start.character,
+          event.range->end.line,
+          event.range->end.character,
+          target_file.editor_content.size(),
+          target_file.editor_content.line_count()
+        );
 
-    for (auto& [_, file]: file_cache) {
-      if (file.abs_path_ == target_file.abs_path_) {
-        // Already re-evaluated, avoid unnecessary work.
-        continue;
+        shifts.emplace_back(event.range.value(), event.text);
       }
 
-      file.RecompileOnLookup();
-    }
+      // Edits are applied right away, compilation waits until typing stops.
+      target_file.version += 1;
+      target_file.ApplyEdits(shifts);
+      snapshots.Touch(file_uri.GetAbsolutePath().path);
+      trace_events::Annotate(file_uri.raw_uri_, target_file.version);
+      recompile_scheduler.Schedule(file_uri.GetAbsolutePath().path, target_file.version);
+
+      mark_importers_stale(file_uri.GetAbsolutePath().path);
+    }, "textDocument/didChange", uri, version);
   });
 
   client_endpoint.registerHandler([&](Notify_TextDocumentDidSave::notify& notify) {
@@ -896,23 +1396,64 @@ int main(int argc, char** argv) {
   });
 
   client_endpoint.registerHandler([&](Notify_TextDocumentDidClose::notify& notify) {
-    if (!initialized) {
-        return;
-    }
-    logger.log(lsp::Log::Level::INFO, "closing file with uri " + notify.params.textDocument.uri.raw_uri_);
-    // Editor asks what to save pending changes in the file before closing.
-    close_file(notify.params.textDocument.uri);
+    std::string uri = notify.params.textDocument.uri.raw_uri_;
+
+    arrival_order.Apply([&, notify = std::move(notify)] {
+      ETUDE_TIMED_SCOPE("notification.textDocument/didClose");
+
+      if (!initialized) {
+          return;
+      }
+
+      const lsDocumentUri& file_uri = notify.params.textDocument.uri;
+
+      std::lock_guard<std::mutex> lock(file_cache_mutex);
+
+      logger.log(lsp::Log::Level::INFO, "closing file with uri " + file_uri.raw_uri_);
+      // Editor asks what to save pending changes in the file before closing.
+      close_file(file_uri);
+
+      // Unsaved changes are gone, importers read the disk again.
+      mark_importers_stale(file_uri.GetAbsolutePath().path);
+      recompile_importers(file_uri.GetAbsolutePath().path);
+    }, "textDocument/didClose", uri);
   });
 
-  auto input  = std::static_pointer_cast<lsp::istream>(std::make_shared<istream<decltype(std::cin)>>(std::cin));
-  auto output = std::static_pointer_cast<lsp::ostream>(std::make_shared<ostream<decltype(std::cout)>>(std::cout));
+  auto input  = std::static_pointer_cast<lsp::istream>(std::make_shared<istream<std::istream>>(ordered_input));
+  auto output = std::static_pointer_cast<lsp::ostream>(std::make_shared<ostream<std::ostream>>(client_output));
   client_endpoint.startProcessingMessages(input, output);
 
+  if (replay != nullptr) {
+    replay->Start([&] {
+      client_endpoint.stop();
+      exiting.store(true);
+      exiting.notify_all();
+    });
+  }
+
   // cppreference: "These functions are guaranteed to return only if
   //   value has changed, even if underlying implementation unblocks
   //   spuriously."
   // https://en.cppreference.com/w/cpp/atomic/atomic/wait
   exiting.wait(false);
 
+  if (replay != nullptr) {
+    replay->Wait();
+  }
+
+  // Changes refer to the scheduler and the recompiler, which go away
+  //   before arrival_order does.
+  arrival_order.Stop();
+
+  async_log::Write(LogLevel::kInfo, latency_stats::Format(latency_stats::Summarize()));
+  trace_events::Finish();
+
+  // Whatever is still queued.
+  async_log::Shutdown();
+
+  if (replay != nullptr) {
+    std::cerr << replay->Report();
+  }
+
   return 0;
 }
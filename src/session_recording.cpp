@@ -0,0 +1,141 @@
+#include "session_recording.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <iterator>
+
+namespace {
+
+constexpr std::string_view kContentLength = "Content-Length";
+constexpr std::string_view kTime = "X-Etude-Time-Us";
+
+// Value of the header, names are case-insensitive. Headers are
+//   "Name: value" lines separated by "\r\n".
+std::optional<uint64_t> FindHeader(std::string_view headers, std::string_view name) {
+  while (!headers.empty()) {
+    size_t line_end = headers.find("\r\n");
+    std::string_view line = headers.substr(0, line_end);
+    headers = line_end == std::string_view::npos ? std::string_view() : headers.substr(line_end + 2);
+
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos || colon != name.size()) {
+      continue;
+    }
+
+    bool same_name = std::equal(name.begin(), name.end(), line.begin(), [](char lhs, char rhs) {
+      return std::tolower(static_cast<unsigned char>(lhs)) == std::tolower(static_cast<unsigned char>(rhs));
+    });
+    if (!same_name) {
+      continue;
+    }
+
+    std::string_view value = line.substr(colon + 1);
+    while (!value.empty() && value.front() == ' ') {
+      value.remove_prefix(1);
+    }
+
+    uint64_t result = 0;
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (error != std::errc()) {
+      return std::nullopt;
+    }
+    return result;
+  }
+  return std::nullopt;
+}
+
+}  // namespace
+
+void MessageFramer::Feed(std::string_view data, const OnMessage& on_message) {
+  buffer_.append(data);
+
+  size_t consumed = 0;
+  while (true) {
+    size_t headers_end = buffer_.find("\r\n\r\n", consumed);
+    if (headers_end == std::string::npos) {
+      break;
+    }
+
+    // Headers are parsed again, if the body hasn't arrived yet. They are
+    //   short, the body may come in thousands of pieces.
+    std::string_view headers(buffer_.data() + consumed, headers_end - consumed);
+    // A message without length can't be skipped properly, take it
+    //   as empty, the next headers are found anyway.
+    size_t content_length = FindHeader(headers, kContentLength).value_or(0);
+
+    size_t body_start = headers_end + 4;
+    if (buffer_.size() < body_start + content_length) {
+      break;
+    }
+
+    std::string body = buffer_.substr(body_start, content_length);
+    on_message(headers, std::move(body));
+    consumed = body_start + content_length;
+  }
+
+  buffer_.erase(0, consumed);
+}
+
+std::optional<std::vector<RecordedMessage>> LoadRecording(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    return std::nullopt;
+  }
+  std::string content(std::istreambuf_iterator<char>(file), {});
+
+  std::vector<RecordedMessage> messages;
+  MessageFramer framer;
+  framer.Feed(content, [&](std::string_view headers, std::string body) {
+    messages.push_back(RecordedMessage{
+      time: std::chrono::microseconds(FindHeader(headers, kTime).value_or(0)),
+      body: std::move(body),
+    });
+  });
+  return messages;
+}
+
+RecordingStreamBuf::RecordingStreamBuf(std::streambuf* source, const std::string& path)
+  : source_(source)
+  , file_(path, std::ios::binary | std::ios::trunc)
+  , start_(Clock::now()) {}
+
+RecordingStreamBuf::int_type RecordingStreamBuf::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+
+  // Blocks until the client sends something, then takes whatever else
+  //   has already arrived.
+  int_type first = source_->sbumpc();
+  if (traits_type::eq_int_type(first, traits_type::eof())) {
+    return traits_type::eof();
+  }
+  buffer_[0] = traits_type::to_char_type(first);
+
+  std::streamsize size = 1;
+  std::streamsize available = std::min<std::streamsize>(source_->in_avail(), sizeof(buffer_) - 1);
+  if (available > 0) {
+    size += source_->sgetn(buffer_ + 1, available);
+  }
+
+  Record(std::string_view(buffer_, size));
+  setg(buffer_, buffer_, buffer_ + size);
+
+  return traits_type::to_int_type(buffer_[0]);
+}
+
+void RecordingStreamBuf::Record(std::string_view data) {
+  if (!file_.is_open()) {
+    return;
+  }
+
+  framer_.Feed(data, [&](std::string_view, std::string body) {
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start_);
+    file_ << kTime << ": " << time.count() << "\r\n"
+          << kContentLength << ": " << body.size() << "\r\n\r\n"
+          << body;
+    // The server may be killed instead of exiting.
+    file_.flush();
+  });
+}
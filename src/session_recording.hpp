@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Splits a byte stream of the base protocol into messages: headers,
+//   an empty line, then Content-Length bytes of JSON.
+class MessageFramer {
+public:
+  using OnMessage = std::function<void(std::string_view headers, std::string body)>;
+
+  // Data may end in the middle of a message, the rest comes with
+  //   the next call.
+  void Feed(std::string_view data, const OnMessage& on_message);
+
+private:
+  // Start of a message, which hasn't arrived completely.
+  std::string buffer_;
+};
+
+// A message of a recorded session and when the server got it, counted
+//   from the start of the recording.
+struct RecordedMessage {
+  std::chrono::microseconds time{0};
+  std::string body;
+};
+
+// A recording is itself a base protocol stream, every message has one
+//   more header: "X-Etude-Time-Us". Nothing, if the file can't be read.
+std::optional<std::vector<RecordedMessage>> LoadRecording(const std::string& path);
+
+// Passes through what the client sends (std::cin), writing down every
+//   message with the time it was received. Turns an editing session into
+//   a benchmark, see SessionReplay.
+class RecordingStreamBuf final : public std::streambuf {
+public:
+  RecordingStreamBuf(std::streambuf* source, const std::string& path);
+
+  bool is_open() const {
+    return file_.is_open();
+  }
+
+protected:
+  int_type underflow() override;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  void Record(std::string_view data);
+
+  std::streambuf* source_;
+  std::ofstream file_;
+  MessageFramer framer_;
+  Clock::time_point start_;
+
+  char buffer_[4096];
+};
@@ -0,0 +1,216 @@
+#include "session_replay.hpp"
+
+#include <utility>
+
+#include <fmt/format.h>
+
+// LspCpp parses JSON with it, so it's there anyway.
+#include "rapidjson/document.h"
+
+namespace {
+
+// Request ids are numbers or strings, "1" and 1 are different ids.
+std::string IdKey(const rapidjson::Value& id) {
+  if (id.IsString()) {
+    return fmt::format("\"{}\"", std::string_view(id.GetString(), id.GetStringLength()));
+  }
+  if (id.IsInt64()) {
+    return std::to_string(id.GetInt64());
+  }
+  return std::string();
+}
+
+struct MessageKind {
+  // Empty for responses.
+  std::string method;
+  // Empty for notifications.
+  std::string id;
+};
+
+MessageKind ClassifyMessage(std::string_view body) {
+  MessageKind kind;
+
+  rapidjson::Document json;
+  json.Parse(body.data(), body.size());
+  if (json.HasParseError() || !json.IsObject()) {
+    return kind;
+  }
+
+  auto method = json.FindMember("method");
+  if (method != json.MemberEnd() && method->value.IsString()) {
+    kind.method.assign(method->value.GetString(), method->value.GetStringLength());
+  }
+
+  auto id = json.FindMember("id");
+  if (id != json.MemberEnd()) {
+    kind.id = IdKey(id->value);
+  }
+
+  return kind;
+}
+
+}  // namespace
+
+void SessionReplay::Pipe::Write(std::string data) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    chunks_.push_back(std::move(data));
+  }
+  readable_.notify_one();
+}
+
+void SessionReplay::Pipe::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  readable_.notify_all();
+}
+
+SessionReplay::Pipe::int_type SessionReplay::Pipe::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  readable_.wait(lock, [&] { return !chunks_.empty() || closed_; });
+  if (chunks_.empty()) {
+    return traits_type::eof();
+  }
+
+  current_ = std::move(chunks_.front());
+  chunks_.pop_front();
+  setg(current_.data(), current_.data(), current_.data() + current_.size());
+
+  return traits_type::to_int_type(*gptr());
+}
+
+std::streamsize SessionReplay::Capture::xsputn(const char* data, std::streamsize size) {
+  framer_.Feed(std::string_view(data, size), [&](std::string_view, std::string body) {
+    replay_->OnServerMessage(std::move(body));
+  });
+  return size;
+}
+
+SessionReplay::Capture::int_type SessionReplay::Capture::overflow(int_type c) {
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    char data = traits_type::to_char_type(c);
+    xsputn(&data, 1);
+  }
+  return traits_type::not_eof(c);
+}
+
+SessionReplay::SessionReplay(std::vector<RecordedMessage> messages, Pace pace)
+  : messages_(std::move(messages))
+  , pace_(pace) {}
+
+SessionReplay::~SessionReplay() {
+  pipe_.Close();
+  Wait();
+}
+
+void SessionReplay::Start(std::function<void()> on_finished) {
+  worker_ = std::thread([this, on_finished = std::move(on_finished)] {
+    Run(on_finished);
+  });
+}
+
+void SessionReplay::Wait() {
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+void SessionReplay::Run(std::function<void()> on_finished) {
+  Clock::time_point started = Clock::now();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    started_ = started;
+  }
+
+  std::chrono::microseconds first_time = messages_.empty() ? std::chrono::microseconds(0) : messages_.front().time;
+
+  for (const RecordedMessage& message: messages_) {
+    MessageKind kind = ClassifyMessage(message.body);
+    if (kind.method == "exit") {
+      continue;
+    }
+
+    if (pace_ == Pace::kRealTime) {
+      std::this_thread::sleep_until(started + (message.time - first_time));
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (kind.id.empty()) {
+        notifications_ += 1;
+      } else {
+        // Before the server sees it, so the response can't come first.
+        requests_ += 1;
+        pending_[kind.id] = PendingRequest{
+          method: std::move(kind.method),
+          sent: Clock::now(),
+        };
+      }
+    }
+
+    pipe_.Write(fmt::format("Content-Length: {}\r\n\r\n{}", message.body.size(), message.body));
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    answered_.wait_for(lock, kResponseTimeout, [&] { return pending_.empty(); });
+    finished_ = Clock::now();
+  }
+
+  pipe_.Close();
+  on_finished();
+}
+
+void SessionReplay::OnServerMessage(std::string body) {
+  Clock::time_point received = Clock::now();
+
+  MessageKind kind = ClassifyMessage(body);
+  if (!kind.method.empty() || kind.id.empty()) {
+    // Notification (diagnostics) or a request of the server.
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = pending_.find(kind.id);
+  if (it == pending_.end()) {
+    return;
+  }
+
+  latencies_[it->second.method].Record(received - it->second.sent);
+  pending_.erase(it);
+
+  if (pending_.empty()) {
+    answered_.notify_all();
+  }
+}
+
+std::string SessionReplay::Report() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  double seconds = std::chrono::duration<double>(finished_ - started_).count();
+  uint64_t messages = requests_ + notifications_;
+
+  std::string report = fmt::format(
+    "replay: {} requests and {} notifications in {:.3f} s, {:.1f} messages/s, {} requests unanswered\n",
+    requests_,
+    notifications_,
+    seconds,
+    seconds > 0 ? messages / seconds : 0.0,
+    pending_.size()
+  );
+
+  std::vector<LatencySummary> summaries;
+  for (const auto& [method, histogram]: latencies_) {
+    summaries.push_back(latency_stats::Summarize(method, histogram));
+  }
+  report += latency_stats::Format(summaries);
+
+  return report;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "latency_stats.hpp"
+#include "session_recording.hpp"
+
+// Plays a recorded session (see RecordingStreamBuf) to the server instead
+//   of an editor, and measures how long every request took: from the
+//   moment it's given to the server to the moment its response is written.
+//
+// The server reads Input() and writes Output() in place of std::cin and
+//   std::cout, nothing else changes for it.
+class SessionReplay {
+public:
+  enum class Pace {
+    // Next message is given right away. Requests queue up, latencies
+    //   include the wait, throughput is what the server can do.
+    kFast,
+    // Messages are given at the times they were recorded, as the editor
+    //   did.
+    kRealTime,
+  };
+
+  SessionReplay(std::vector<RecordedMessage> messages, Pace pace);
+  ~SessionReplay();
+
+  SessionReplay(const SessionReplay&) = delete;
+  SessionReplay& operator=(const SessionReplay&) = delete;
+
+  std::istream& Input() {
+    return input_;
+  }
+
+  std::ostream& Output() {
+    return output_;
+  }
+
+  // Gives messages to the server on a separate thread. The "exit"
+  //   notification is held back: once every request is answered (or
+  //   kResponseTimeout has passed), Input() ends and on_finished is
+  //   called instead.
+  void Start(std::function<void()> on_finished);
+
+  // Until on_finished has returned.
+  void Wait();
+
+  // Latency of every method, number of messages, throughput.
+  std::string Report() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr std::chrono::seconds kResponseTimeout{30};
+
+  // What the replay writes, the server reads. Blocks until there is
+  //   something to read.
+  class Pipe final : public std::streambuf {
+  public:
+    void Write(std::string data);
+    void Close();
+
+  protected:
+    int_type underflow() override;
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable readable_;
+    std::deque<std::string> chunks_;
+    bool closed_ = false;
+
+    // Chunk being read, get area points into it.
+    std::string current_;
+  };
+
+  // What the server writes, parsed into responses.
+  class Capture final : public std::streambuf {
+  public:
+    explicit Capture(SessionReplay* replay)
+      : replay_(replay) {}
+
+  protected:
+    std::streamsize xsputn(const char* data, std::streamsize size) override;
+    int_type overflow(int_type c) override;
+
+  private:
+    SessionReplay* replay_;
+    MessageFramer framer_;
+  };
+
+  struct PendingRequest {
+    std::string method;
+    Clock::time_point sent;
+  };
+
+  void Run(std::function<void()> on_finished);
+  void OnServerMessage(std::string body);
+
+  const std::vector<RecordedMessage> messages_;
+  const Pace pace_;
+
+  Pipe pipe_;
+  Capture capture_{this};
+  std::istream input_{&pipe_};
+  std::ostream output_{&capture_};
+
+  mutable std::mutex mutex_;
+  std::condition_variable answered_;
+  // By request id, as written in JSON.
+  std::unordered_map<std::string, PendingRequest> pending_;
+  // Latency of requests by method. Nodes are stable, histograms aren't
+  //   movable.
+  std::map<std::string, LatencyHistogram> latencies_;
+  uint64_t requests_ = 0;
+  uint64_t notifications_ = 0;
+  Clock::time_point started_;
+  Clock::time_point finished_;
+
+  std::thread worker_;
+};
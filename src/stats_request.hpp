@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// LibLsp.
+#include "LibLsp/JsonRpc/RequestInMessage.h"
+#include "LibLsp/JsonRpc/lsResponseMessage.h"
+#include "LibLsp/JsonRpc/serializer.h"
+
+// Custom request "$/etude/stats": latency histograms of compilation
+//   phases and request handlers, collected since start or the last reset.
+//   Durations are in milliseconds.
+
+struct EtudeStatsParams {
+  // Start collecting anew after the response is made.
+  bool reset = false;
+};
+MAKE_REFLECT_STRUCT(EtudeStatsParams, reset);
+
+struct EtudeLatencyStats {
+  std::string name;
+  uint64_t count = 0;
+  double mean_ms = 0;
+  double p50_ms = 0;
+  double p90_ms = 0;
+  double p99_ms = 0;
+  double max_ms = 0;
+};
+MAKE_REFLECT_STRUCT(EtudeLatencyStats, name, count, mean_ms, p50_ms, p90_ms, p99_ms, max_ms);
+
+DEFINE_REQUEST_RESPONSE_TYPE(etude_stats, EtudeStatsParams, std::vector<EtudeLatencyStats>, "$/etude/stats");
@@ -0,0 +1,125 @@
+#include "symbol_table.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <utility>
+
+SymbolTable::SymbolTable(const std::vector<lsDocumentSymbol>& symbols) {
+  NameIds name_ids;
+  for (const lsDocumentSymbol& symbol: symbols) {
+    Add(symbol, kNoParent, &name_ids);
+  }
+  names_.shrink_to_fit();
+}
+
+void SymbolTable::Add(const lsDocumentSymbol& symbol, uint32_t parent, NameIds* name_ids) {
+  auto [it, inserted] = name_ids->try_emplace(symbol.name, static_cast<uint32_t>(names_.size()));
+  if (inserted) {
+    names_.push_back(symbol.name);
+  }
+
+  assert(static_cast<int>(symbol.kind) >= 0 && static_cast<int>(symbol.kind) <= std::numeric_limits<uint8_t>::max());
+  assert(symbol.selectionRange.start.line == symbol.selectionRange.end.line);
+
+  uint32_t index = static_cast<uint32_t>(size());
+
+  parents_.push_back(parent);
+  name_ids_.push_back(it->second);
+  kinds_.push_back(static_cast<uint8_t>(symbol.kind));
+  range_starts_.push_back(PackPosition(symbol.range.start));
+  range_ends_.push_back(PackPosition(symbol.range.end));
+  selection_starts_.push_back(PackPosition(symbol.selectionRange.start));
+  selection_end_columns_.push_back(static_cast<uint32_t>(symbol.selectionRange.end.character));
+
+  if (symbol.children.has_value()) {
+    for (const lsDocumentSymbol& child: symbol.children.value()) {
+      Add(child, index, name_ids);
+    }
+  }
+}
+
+std::vector<lsDocumentSymbol> SymbolTable::ToLsp() const {
+  std::vector<lsDocumentSymbol> symbols;
+  symbols.reserve(size());
+
+  for (size_t i = 0; i < size(); i += 1) {
+    lsPosition selection_start = UnpackPosition(selection_starts_[i]);
+    lsPosition selection_end = selection_start;
+    selection_end.character = static_cast<int>(selection_end_columns_[i]);
+
+    symbols.push_back(lsDocumentSymbol{
+      name: names_[name_ids_[i]],
+      kind: static_cast<lsSymbolKind>(kinds_[i]),
+      range: lsRange(UnpackPosition(range_starts_[i]), UnpackPosition(range_ends_[i])),
+      selectionRange: lsRange(selection_start, selection_end),
+    });
+  }
+
+  // Children go after the parent, so going from the end every symbol
+  //   is complete, when it's moved into the parent. Children come out
+  //   reversed.
+  std::vector<lsDocumentSymbol> roots;
+  for (size_t i = size(); i > 0; i -= 1) {
+    lsDocumentSymbol& symbol = symbols[i - 1];
+    if (symbol.children.has_value()) {
+      std::reverse(symbol.children->begin(), symbol.children->end());
+    }
+
+    uint32_t parent = parents_[i - 1];
+    if (parent == kNoParent) {
+      roots.push_back(std::move(symbol));
+      continue;
+    }
+
+    auto& siblings = symbols[parent].children;
+    if (!siblings.has_value()) {
+      siblings.emplace();
+    }
+    siblings->push_back(std::move(symbol));
+  }
+  std::reverse(roots.begin(), roots.end());
+
+  return roots;
+}
+
+void SymbolTable::ApplyEdit(const PositionShift& shift) {
+  // Not sorted by position: a function encloses the symbols after its
+  //   start. Symbols are a few bytes each here, a pass over them is cheap.
+  //
+  // New index of every symbol, for a dropped one that's where its
+  //   children go. Parents are before children, their new index is known.
+  std::vector<uint32_t> new_index(size());
+
+  size_t kept = 0;
+  for (size_t i = 0; i < size(); i += 1) {
+    uint32_t parent = parents_[i] != kNoParent ? new_index[parents_[i]] : kNoParent;
+
+    uint64_t selection_end = PackPosition(PackedLine(selection_starts_[i]), selection_end_columns_[i]);
+    if (shift.Touches(selection_starts_[i], selection_end)) {
+      new_index[i] = parent;
+      continue;
+    }
+    new_index[i] = static_cast<uint32_t>(kept);
+
+    parents_[kept] = parent;
+    name_ids_[kept] = name_ids_[i];
+    kinds_[kept] = kinds_[i];
+    range_starts_[kept] = shift.Map(range_starts_[i]);
+    range_ends_[kept] = shift.Map(range_ends_[i]);
+    selection_starts_[kept] = shift.Map(selection_starts_[i]);
+    selection_end_columns_[kept] = PackedColumn(shift.Map(selection_end));
+    kept += 1;
+  }
+
+  parents_.resize(kept);
+  name_ids_.resize(kept);
+  kinds_.resize(kept);
+  range_starts_.resize(kept);
+  range_ends_.resize(kept);
+  selection_starts_.resize(kept);
+  selection_end_columns_.resize(kept);
+
+  // Names of dropped symbols stay, they are likely to come back after
+  //   the next compilation anyway.
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// LibLsp.
+#include "LibLsp/lsp/lsRange.h"
+#include "LibLsp/lsp/textDocument/document_symbol.h"
+
+#include "packed_position.hpp"
+
+// Document outline of a file, as columns. Tree is flattened in preorder,
+//   each symbol knows its parent: functions hold their parameters and
+//   locals, types hold their members. Names are interned, locals are
+//   often named alike. lsDocumentSymbol-s are made only for
+//   the documentSymbol request.
+class SymbolTable {
+public:
+  SymbolTable() = default;
+  explicit SymbolTable(const std::vector<lsDocumentSymbol>& symbols);
+
+  // Same tree, in the order symbols were found by the visitor.
+  std::vector<lsDocumentSymbol> ToLsp() const;
+
+  // Symbols, whose name the edit touches, are dropped, their children
+  //   go to the parent. The rest move with the text, ranges of functions
+  //   around the edit grow or shrink.
+  void ApplyEdit(const PositionShift& shift);
+
+  size_t size() const {
+    return name_ids_.size();
+  }
+
+private:
+  static constexpr uint32_t kNoParent = UINT32_MAX;
+
+  using NameIds = std::unordered_map<std::string, uint32_t>;
+
+  void Add(const lsDocumentSymbol& symbol, uint32_t parent, NameIds* name_ids);
+
+  // Columns, one entry per symbol. Selection is the name of the symbol,
+  //   a single token, so its end is just a column. Parent goes before
+  //   its children.
+  std::vector<uint32_t> parents_;
+  std::vector<uint32_t> name_ids_;
+  std::vector<uint8_t> kinds_;
+  std::vector<uint64_t> range_starts_;
+  std::vector<uint64_t> range_ends_;
+  std::vector<uint64_t> selection_starts_;
+  std::vector<uint32_t> selection_end_columns_;
+
+  std::vector<std::string> names_;
+};
@@ -0,0 +1,52 @@
+#include "thread_pool.hpp"
+
+#include <utility>
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  threads_.reserve(num_threads);
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back([this] { Run(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    tasks_.clear();
+  }
+  has_tasks_.notify_all();
+
+  for (std::thread& thread: threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_) {
+      return;
+    }
+    tasks_.push_back(std::move(task));
+  }
+  has_tasks_.notify_one();
+}
+
+void ThreadPool::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true) {
+    has_tasks_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+    if (stopping_) {
+      return;
+    }
+
+    std::function<void()> task = std::move(tasks_.front());
+    tasks_.pop_front();
+
+    lock.unlock();
+    task();
+    lock.lock();
+  }
+}
@@ -0,0 +1,224 @@
+#include "trace_events.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "async_log.hpp"
+
+namespace trace_events {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t kNoDocument = UINT32_MAX;
+
+// A long session must not eat all the memory. Later spans of the thread
+//   are dropped and counted.
+constexpr size_t kMaxEventsPerThread = size_t(1) << 20;
+
+struct Event {
+  std::string_view name;
+  int64_t start_ns = 0;
+  int64_t duration_ns = 0;
+  uint32_t uri_id = kNoDocument;
+  uint64_t version = 0;
+};
+
+struct OpenSpan {
+  std::string_view name;
+  Clock::time_point start;
+  uint32_t uri_id = kNoDocument;
+  uint64_t version = 0;
+};
+
+// Written by its thread only. The mutex is there for Finish(), so it's
+//   never contended while the server runs.
+struct ThreadBuffer {
+  uint32_t tid = 0;
+
+  std::mutex mutex;
+  std::vector<Event> events;
+  std::vector<std::string> uris;
+  uint64_t dropped = 0;
+
+  // Not shared with Finish(), no lock needed.
+  std::vector<OpenSpan> open;
+  std::unordered_map<std::string, uint32_t> uri_ids;
+};
+
+struct Trace {
+  std::string path;
+  Clock::time_point origin;
+
+  std::mutex mutex;
+  // Buffers outlive their threads, spans of the finished threads are
+  //   written too.
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+};
+
+Trace& Instance() {
+  static Trace trace;
+  return trace;
+}
+
+ThreadBuffer& ThisThreadBuffer() {
+  thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+    auto created = std::make_shared<ThreadBuffer>();
+
+    Trace& trace = Instance();
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    created->tid = static_cast<uint32_t>(trace.buffers.size()) + 1;
+    trace.buffers.push_back(created);
+
+    return created;
+  }();
+  return *buffer;
+}
+
+void WriteEscaped(std::string& out, std::string_view text) {
+  for (char c: text) {
+    switch (c) {
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          out += fmt::format("\\u{:04x}", static_cast<unsigned>(c));
+        } else {
+          out += c;
+        }
+    }
+  }
+}
+
+}  // namespace
+
+void Start(std::string path) {
+  Trace& trace = Instance();
+  trace.path = std::move(path);
+  trace.origin = Clock::now();
+  detail::enabled.store(true, std::memory_order_relaxed);
+}
+
+void Annotate(std::string_view uri, uint64_t version) {
+  if (!Enabled()) {
+    return;
+  }
+
+  ThreadBuffer& buffer = ThisThreadBuffer();
+  if (buffer.open.empty()) {
+    return;
+  }
+
+  auto [it, inserted] = buffer.uri_ids.try_emplace(std::string(uri), static_cast<uint32_t>(buffer.uri_ids.size()));
+  if (inserted) {
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.uris.push_back(it->first);
+  }
+
+  buffer.open.back().uri_id = it->second;
+  buffer.open.back().version = version;
+}
+
+void Finish() {
+  if (!Enabled()) {
+    return;
+  }
+  detail::enabled.store(false, std::memory_order_relaxed);
+
+  Trace& trace = Instance();
+
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  {
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    buffers = trace.buffers;
+  }
+
+  std::string out = "{\"traceEvents\":[\n";
+  bool first = true;
+  uint64_t dropped = 0;
+
+  for (const auto& buffer: buffers) {
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    dropped += buffer->dropped;
+
+    for (const Event& event: buffer->events) {
+      if (!first) {
+        out += ",\n";
+      }
+      first = false;
+
+      out += "{\"name\":\"";
+      WriteEscaped(out, event.name);
+      out += fmt::format(
+        "\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}",
+        buffer->tid,
+        event.start_ns / 1000.0,
+        event.duration_ns / 1000.0
+      );
+      if (event.uri_id != kNoDocument) {
+        out += ",\"args\":{\"uri\":\"";
+        WriteEscaped(out, buffer->uris[event.uri_id]);
+        out += fmt::format("\",\"version\":{}}}", event.version);
+      }
+      out += "}";
+    }
+  }
+  out += "\n]}\n";
+
+  std::ofstream file(trace.path, std::ios::binary | std::ios::trunc);
+  file << out;
+  if (!file && async_log::Enabled(LogLevel::kError)) {
+    async_log::Write(LogLevel::kError, fmt::format("couldn't write trace to \"{}\"", trace.path));
+  }
+  if (dropped != 0 && async_log::Enabled(LogLevel::kWarning)) {
+    async_log::Write(LogLevel::kWarning, fmt::format("trace: {} spans dropped, buffers were full", dropped));
+  }
+}
+
+void Span::Begin(std::string_view name) {
+  ThreadBuffer& buffer = ThisThreadBuffer();
+
+  OpenSpan span{name: name, start: Clock::now()};
+  if (!buffer.open.empty()) {
+    span.uri_id = buffer.open.back().uri_id;
+    span.version = buffer.open.back().version;
+  }
+  buffer.open.push_back(span);
+
+  active_ = true;
+}
+
+void Span::End() {
+  Clock::time_point end = Clock::now();
+
+  ThreadBuffer& buffer = ThisThreadBuffer();
+  OpenSpan span = buffer.open.back();
+  buffer.open.pop_back();
+
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  if (buffer.events.size() >= kMaxEventsPerThread) {
+    buffer.dropped += 1;
+    return;
+  }
+
+  const Clock::time_point origin = Instance().origin;
+  buffer.events.push_back(Event{
+    name: span.name,
+    start_ns: std::chrono::duration_cast<std::chrono::nanoseconds>(span.start - origin).count(),
+    duration_ns: std::chrono::duration_cast<std::chrono::nanoseconds>(end - span.start).count(),
+    uri_id: span.uri_id,
+    version: span.version,
+  });
+}
+
+}  // namespace trace_events
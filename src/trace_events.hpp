@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Timeline of the server in Chrome trace-event format, can be opened in
+//   chrome://tracing or ui.perfetto.dev. Off by default, is switched on
+//   with --trace-file=<path> or ETUDE_LSP_TRACE_FILE=<path>.
+//
+// Every thread buffers its spans in memory, the file is written once
+//   on exit. Spans are nested: document (uri and version) of a span is
+//   inherited by the spans started inside of it.
+namespace trace_events {
+
+namespace detail {
+
+inline std::atomic<bool> enabled = false;
+
+}  // namespace detail
+
+inline bool Enabled() {
+  return detail::enabled.load(std::memory_order_relaxed);
+}
+
+// Call before other threads are started.
+void Start(std::string path);
+
+// Tags the innermost span of this thread, which is still running,
+//   with the document it works on.
+void Annotate(std::string_view uri, uint64_t version);
+
+// Writes spans of all threads to the file. Spans still running are
+//   not written.
+void Finish();
+
+// Name must outlive the trace (string literals do).
+class Span {
+public:
+  explicit Span(std::string_view name) {
+    if (Enabled()) {
+      Begin(name);
+    }
+  }
+
+  ~Span() {
+    if (active_) {
+      End();
+    }
+  }
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+private:
+  void Begin(std::string_view name);
+  void End();
+
+  bool active_ = false;
+};
+
+}  // namespace trace_events
@@ -0,0 +1,16 @@
+#include "type_names.hpp"
+
+#include <cassert>
+
+TypeNames::TypeNames(const std::vector<types::Type*>& types) {
+  names_.reserve(types.size());
+  for (types::Type* type: types) {
+    assert(type != nullptr);
+    names_.emplace(type, type->Format());
+  }
+}
+
+std::string TypeNames::Format(types::Type* type) const {
+  auto it = names_.find(type);
+  return it != names_.end() ? it->second : std::string();
+}
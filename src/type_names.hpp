@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Etude compiler.
+#include "driver/compil_driver.hpp"
+
+// Formatted names of the types of usages, for the results of one
+//   compilation. Formatting follows type variables through the storage,
+//   which any running compilation may be changing, so the names are made
+//   by the compilation itself, while it holds the compiler globals lock.
+//   Queries only read them: a hover never waits for a compilation.
+//
+// Types are owned by the compilation, so the names are dropped together
+//   with its results.
+class TypeNames {
+public:
+  TypeNames() = default;
+
+  // Must be called with the compiler globals lock held. Each type once.
+  explicit TypeNames(const std::vector<types::Type*>& types);
+
+  // Empty, if the type isn't of this compilation.
+  std::string Format(types::Type* type) const;
+
+private:
+  std::unordered_map<types::Type*, std::string> names_;
+};
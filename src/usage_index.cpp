@@ -0,0 +1,368 @@
+#include "usage_index.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+// LibLsp.
+#include "LibLsp/lsp/utils.h"
+
+#include "content_hash.hpp"
+
+namespace {
+
+// Same fields as operator==(SymbolDeclDefInfo, SymbolDeclDefInfo).
+struct SymbolDeclDefInfoHash {
+  size_t operator()(const SymbolDeclDefInfo& info) const {
+    uint64_t hash = 0;
+    for (const lex::Location* location: {&info.decl_position, &info.def_position}) {
+      hash = HashCombine(hash, reinterpret_cast<uintptr_t>(location->unit));
+      hash = HashCombine(hash, location->lineno);
+      hash = HashCombine(hash, location->columnno);
+    }
+    return hash;
+  }
+};
+
+// Dense ids for values, in the order of first appearance.
+template <typename T, typename Hash = std::hash<T>>
+class Interner {
+public:
+  explicit Interner(std::vector<T>* values)
+    : values_(values) {}
+
+  uint32_t Intern(const T& value) {
+    auto [it, inserted] = ids_.try_emplace(value, static_cast<uint32_t>(values_->size()));
+    if (inserted) {
+      values_->push_back(value);
+    }
+    return it->second;
+  }
+
+private:
+  std::vector<T>* values_;
+  std::unordered_map<T, uint32_t, Hash> ids_;
+};
+
+}  // namespace
+
+UsageIndex::UsageIndex(const std::vector<SymbolUsage>& usages, const std::string& file_path) {
+  assert(usages.size() < std::numeric_limits<uint32_t>::max());
+
+  // Visitor goes in the order of the AST, which isn't necessarily
+  //   the order of the text.
+  std::vector<uint32_t> order(usages.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t lhs, uint32_t rhs) {
+    return PackPosition(usages[lhs].range.start) < PackPosition(usages[rhs].range.start);
+  });
+
+  starts_.reserve(usages.size());
+  end_columns_.reserve(usages.size());
+  declaration_ids_.reserve(usages.size());
+  type_ids_.reserve(usages.size());
+  flags_.reserve(usages.size());
+
+  Interner<Unit> units(&units_);
+  Interner<types::Type*> types(&types_);
+
+  std::vector<SymbolDeclDefInfo> declarations;
+  Interner<SymbolDeclDefInfo, SymbolDeclDefInfoHash> declaration_ids(&declarations);
+
+  for (uint32_t i: order) {
+    const SymbolUsage& usage = usages[i];
+
+    // Все токены однострочные.
+    assert(usage.range.start.line == usage.range.end.line);
+
+    starts_.push_back(PackPosition(usage.range.start));
+    end_columns_.push_back(static_cast<uint32_t>(usage.range.end.character));
+    declaration_ids_.push_back(declaration_ids.Intern(usage.decl_def));
+    type_ids_.push_back(usage.type != nullptr ? types.Intern(usage.type) : kNoType);
+    flags_.push_back((usage.is_decl ? kIsDecl : 0) | (usage.is_def ? kIsDef : 0));
+  }
+
+  live_usages_ = starts_.size();
+
+  auto pack = [&](const lex::Location& location) {
+    assert(location.lineno <= UINT32_MAX && location.columnno <= UINT32_MAX);
+    return PackedLocation{
+      unit: units.Intern(location.unit),
+      line: static_cast<uint32_t>(location.lineno),
+      column: static_cast<uint32_t>(location.columnno),
+    };
+  };
+
+  declarations_.reserve(declarations.size());
+  for (const SymbolDeclDefInfo& info: declarations) {
+    declarations_.push_back(Declaration{
+      decl: pack(info.decl_position),
+      def: pack(info.def_position),
+      is_exported: info.is_exported,
+      is_local: false,
+      is_dropped: false,
+    });
+  }
+
+  // Declaration and definition are always in the same module.
+  std::vector<bool> local_units(units_.size());
+  for (size_t i = 0; i < units_.size(); i += 1) {
+    local_units[i] = units_[i] != nullptr && lsp::NormalizePath(units_[i]->GetAbsPath().string(), false) == file_path;
+  }
+  for (Declaration& declaration: declarations_) {
+    declaration.is_local = local_units[declaration.decl.unit];
+  }
+
+  IndexOccurrences();
+}
+
+std::optional<UsageIndex::UsageId> UsageIndex::Find(const lsPosition& position) const {
+  // First usage starting after the position, the one before it is
+  //   the only candidate.
+  uint64_t packed = PackPosition(position);
+  auto it = std::upper_bound(starts_.begin(), starts_.end(), packed);
+  if (it == starts_.begin()) {
+    return std::nullopt;
+  }
+  --it;
+
+  // Токен не может продолжаться на следующей строке, перевод строки --
+  //   разделитель. Потому можно смотреть на строку начала.
+  if (PackedLine(*it) != PackedLine(packed)) {
+    return std::nullopt;
+  }
+
+  UsageId usage = static_cast<UsageId>(it - starts_.begin());
+  if (IsDropped(usage)) {
+    // Live usages before a dropped one end before it, so none of them
+    //   contains the position either.
+    return std::nullopt;
+  }
+
+  // Разрешаем равенство, т.к. можно встать сразу после символа,
+  //   это все еще разрешено.
+  if (PackedColumn(packed) > end_columns_[usage]) {
+    return std::nullopt;
+  }
+
+  return usage;
+}
+
+lsRange UsageIndex::RangeOf(UsageId usage) const {
+  lsPosition start = UnpackPosition(starts_[usage]);
+  lsPosition end = start;
+  end.character = static_cast<int>(end_columns_[usage]);
+  return lsRange{std::move(start), std::move(end)};
+}
+
+types::Type* UsageIndex::TypeOf(UsageId usage) const {
+  uint32_t type_id = type_ids_[usage];
+  return type_id != kNoType ? types_[type_id] : nullptr;
+}
+
+lex::Location UsageIndex::DeclPositionOf(DeclarationId declaration) const {
+  return Unpack(declarations_[declaration].decl);
+}
+
+lex::Location UsageIndex::DefPositionOf(DeclarationId declaration) const {
+  return Unpack(declarations_[declaration].def);
+}
+
+std::vector<UsageIndex::UsageId> UsageIndex::OccurrencesOf(DeclarationId declaration) const {
+  if (declarations_[declaration].is_dropped) {
+    return {};
+  }
+
+  std::vector<UsageId> result;
+  for (uint32_t i = occurrence_begin_[declaration]; i < occurrence_begin_[declaration + 1]; i += 1) {
+    if (!IsDropped(occurrences_[i])) {
+      result.push_back(occurrences_[i]);
+    }
+  }
+  return result;
+}
+
+void UsageIndex::ApplyEdit(const PositionShift& shift) {
+  // Usages before the edit stay as they are. Only the last of them may
+  //   reach the edit: tokens don't overlap. Dropped ones are collapsed
+  //   to a point, those may be there as well.
+  size_t first = std::lower_bound(starts_.begin(), starts_.end(), shift.Start()) - starts_.begin();
+  while (first > 0) {
+    uint64_t end = PackPosition(PackedLine(starts_[first - 1]), end_columns_[first - 1]);
+    if (end < shift.Start()) {
+      break;
+    }
+    first -= 1;
+  }
+
+  for (size_t i = first; i < starts_.size(); i += 1) {
+    uint64_t end = PackPosition(PackedLine(starts_[i]), end_columns_[i]);
+
+    if (shift.Touches(starts_[i], end)) {
+      if ((flags_[i] & kDropped) == 0) {
+        flags_[i] |= kDropped;
+        live_usages_ -= 1;
+      }
+
+      starts_[i] = shift.Start();
+      end_columns_[i] = PackedColumn(shift.Start());
+      continue;
+    }
+
+    starts_[i] = shift.Map(starts_[i]);
+    end_columns_[i] = PackedColumn(shift.Map(end));
+  }
+
+  for (DeclarationId id = 0; id < declarations_.size(); id += 1) {
+    Declaration& declaration = declarations_[id];
+    if (!declaration.is_local || declaration.is_dropped) {
+      continue;
+    }
+
+    ApplyEdit(shift, &declaration.decl, &declaration.is_dropped);
+    ApplyEdit(shift, &declaration.def, &declaration.is_dropped);
+
+    if (declaration.is_dropped) {
+      for (uint32_t i = occurrence_begin_[id]; i < occurrence_begin_[id + 1]; i += 1) {
+        if ((flags_[occurrences_[i]] & kDropped) == 0) {
+          flags_[occurrences_[i]] |= kDropped;
+          live_usages_ -= 1;
+        }
+      }
+    }
+  }
+}
+
+void UsageIndex::ApplyEdit(const PositionShift& shift, PackedLocation* location, bool* dropped) {
+  // Location of a token is the position right after it.
+  uint64_t packed = PackPosition(location->line, location->column);
+  if (shift.Touches(packed, packed)) {
+    *dropped = true;
+    return;
+  }
+
+  packed = shift.Map(packed);
+  location->line = PackedLine(packed);
+  location->column = PackedColumn(packed);
+}
+
+lex::Location UsageIndex::Unpack(const PackedLocation& location) const {
+  lex::Location result;
+  result.unit = units_[location.unit];
+  result.lineno = location.line;
+  result.columnno = location.column;
+  return result;
+}
+
+void UsageIndex::IndexOccurrences() {
+  // Counting sort of usages by declaration, stable: usages of
+  //   a declaration stay in the order of the text.
+  occurrence_begin_.assign(declarations_.size() + 1, 0);
+  for (DeclarationId declaration: declaration_ids_) {
+    occurrence_begin_[declaration + 1] += 1;
+  }
+  std::partial_sum(occurrence_begin_.begin(), occurrence_begin_.end(), occurrence_begin_.begin());
+
+  occurrences_.resize(declaration_ids_.size());
+  std::vector<uint32_t> next(occurrence_begin_.begin(), occurrence_begin_.end() - 1);
+  for (size_t i = 0; i < declaration_ids_.size(); i += 1) {
+    occurrences_[next[declaration_ids_[i]]++] = static_cast<UsageId>(i);
+  }
+}
+
+std::optional<EditedUsages::UsageId> EditedUsages::Find(const lsPosition& position) const {
+  // Back to the text the index was built for.
+  uint64_t packed = PackPosition(position);
+  for (auto it = shifts_->rbegin(); it != shifts_->rend(); ++it) {
+    std::optional<uint64_t> before = it->Unmap(packed);
+    if (!before.has_value()) {
+      // Typed since, nothing known there.
+      return std::nullopt;
+    }
+    packed = *before;
+  }
+
+  std::optional<UsageId> usage = index_->Find(UnpackPosition(packed));
+  if (!usage.has_value() || IsUsageDropped(*usage)) {
+    return std::nullopt;
+  }
+  return usage;
+}
+
+lsRange EditedUsages::RangeOf(UsageId usage) const {
+  uint64_t start = index_->starts_[usage];
+  uint64_t end = PackPosition(PackedLine(start), index_->end_columns_[usage]);
+  Move(&start, &end);
+
+  lsPosition end_position = UnpackPosition(start);
+  end_position.character = static_cast<int>(PackedColumn(end));
+  return lsRange{UnpackPosition(start), std::move(end_position)};
+}
+
+lex::Location EditedUsages::DeclPositionOf(DeclarationId declaration) const {
+  lex::Location location = index_->DeclPositionOf(declaration);
+  if (index_->declarations_[declaration].is_local) {
+    uint64_t packed = PackPosition(location.lineno, location.columnno);
+    Move(&packed);
+    location.lineno = PackedLine(packed);
+    location.columnno = PackedColumn(packed);
+  }
+  return location;
+}
+
+std::vector<EditedUsages::UsageId> EditedUsages::OccurrencesOf(DeclarationId declaration) const {
+  if (IsDeclarationDropped(declaration)) {
+    return {};
+  }
+
+  std::vector<UsageId> result = index_->OccurrencesOf(declaration);
+  std::erase_if(result, [&](UsageId usage) {
+    uint64_t start = index_->starts_[usage];
+    uint64_t end = PackPosition(PackedLine(start), index_->end_columns_[usage]);
+    return !Move(&start, &end);
+  });
+  return result;
+}
+
+bool EditedUsages::Move(uint64_t* position) const {
+  uint64_t last = *position;
+  return Move(position, &last);
+}
+
+bool EditedUsages::Move(uint64_t* first, uint64_t* last) const {
+  for (const PositionShift& shift: *shifts_) {
+    if (shift.Touches(*first, *last)) {
+      return false;
+    }
+    *first = shift.Map(*first);
+    *last = shift.Map(*last);
+  }
+  return true;
+}
+
+bool EditedUsages::IsUsageDropped(UsageId usage) const {
+  if (index_->IsDropped(usage)) {
+    return true;
+  }
+
+  uint64_t start = index_->starts_[usage];
+  uint64_t end = PackPosition(PackedLine(start), index_->end_columns_[usage]);
+  return !Move(&start, &end) || IsDeclarationDropped(index_->DeclarationOf(usage));
+}
+
+bool EditedUsages::IsDeclarationDropped(DeclarationId declaration) const {
+  const UsageIndex::Declaration& info = index_->declarations_[declaration];
+  if (info.is_dropped) {
+    return true;
+  }
+  if (!info.is_local || shifts_->empty()) {
+    return false;
+  }
+
+  // Location of a token is the position right after it.
+  uint64_t decl = PackPosition(info.decl.line, info.decl.column);
+  uint64_t def = PackPosition(info.def.line, info.def.column);
+  return !Move(&decl) || !Move(&def);
+}
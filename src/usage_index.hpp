@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// LibLsp.
+#include "LibLsp/lsp/lsRange.h"
+
+#include "lsp_visitor.hpp"
+#include "packed_position.hpp"
+
+// Usages of a file, sorted by position, so that the usage under the
+//   cursor is found by binary search instead of looking through all of
+//   them. Hover is requested on every mouse move, that adds up.
+//
+// Also knows all usages of every declaration, so that highlight and
+//   rename don't compare the symbol with each usage of the file.
+//
+// Stored as columns: lookups and invalidation read only the few bytes
+//   they need of each usage. Declarations, compilation units and types
+//   repeat a lot, they are stored once and referenced by 32-bit ids.
+//
+// Built once, after the visitor has collected usages. Until the next
+//   compilation edits are applied to it (or to what queries read of it,
+//   see EditedUsages): usages after an edit move with the text, usages
+//   touching it are dropped. Queries keep working while a recompilation
+//   is pending or failing.
+class UsageIndex {
+public:
+  using UsageId = uint32_t;
+  using DeclarationId = uint32_t;
+
+  UsageIndex() = default;
+
+  // file_path is normalized (see lsp::NormalizePath) path of the file
+  //   usages are in. Only declarations in this file move with edits.
+  UsageIndex(const std::vector<SymbolUsage>& usages, const std::string& file_path);
+
+  // Usage, which contains the position. The position right after the
+  //   last character counts as well: the cursor is often left there.
+  std::optional<UsageId> Find(const lsPosition& position) const;
+
+  lsRange RangeOf(UsageId usage) const;
+
+  DeclarationId DeclarationOf(UsageId usage) const {
+    return declaration_ids_[usage];
+  }
+
+  bool IsDecl(UsageId usage) const {
+    return (flags_[usage] & kIsDecl) != 0;
+  }
+
+  bool IsDef(UsageId usage) const {
+    return (flags_[usage] & kIsDef) != 0;
+  }
+
+  // nullptr, if the type is unknown.
+  types::Type* TypeOf(UsageId usage) const;
+
+  // Every type TypeOf can give, once.
+  const std::vector<types::Type*>& Types() const {
+    return types_;
+  }
+
+  lex::Location DeclPositionOf(DeclarationId declaration) const;
+  lex::Location DefPositionOf(DeclarationId declaration) const;
+
+  // All usages of the declaration, in the order of the text.
+  std::vector<UsageId> OccurrencesOf(DeclarationId declaration) const;
+
+  // Dropped usages stay in the columns, marked, so that ids and the
+  //   occurrence index stay valid. Positions of the rest are adjusted:
+  //   costs a binary search and a pass over the usages after the edit.
+  void ApplyEdit(const PositionShift& shift);
+
+  // Usages, which weren't dropped.
+  size_t size() const {
+    return live_usages_;
+  }
+
+private:
+  friend class EditedUsages;
+
+  using Unit = decltype(lex::Location::unit);
+
+  static constexpr uint32_t kNoType = UINT32_MAX;
+
+  enum UsageFlags : uint8_t {
+    kIsDecl  = 1 << 0,
+    kIsDef   = 1 << 1,
+    kDropped = 1 << 2,
+  };
+
+  struct PackedLocation {
+    uint32_t unit;
+    uint32_t line;
+    uint32_t column;
+  };
+
+  struct Declaration {
+    PackedLocation decl;
+    PackedLocation def;
+    bool is_exported;
+
+    // Declared in this file, moves with edits.
+    bool is_local;
+
+    // Edit touched the declaration, all its usages are dropped with it.
+    bool is_dropped;
+  };
+
+  bool IsDropped(UsageId usage) const {
+    return (flags_[usage] & kDropped) != 0;
+  }
+
+  static void ApplyEdit(const PositionShift& shift, PackedLocation* location, bool* dropped);
+
+  lex::Location Unpack(const PackedLocation& location) const;
+
+  void IndexOccurrences();
+
+  // Columns, one entry per usage, sorted by start. Tokens are never
+  //   multiline and never overlap, so the end is just a column. Dropped
+  //   usages are collapsed to the start of the edit, that keeps the order.
+  std::vector<uint64_t> starts_;
+  std::vector<uint32_t> end_columns_;
+  std::vector<DeclarationId> declaration_ids_;
+  std::vector<uint32_t> type_ids_;
+  std::vector<uint8_t> flags_;
+
+  std::vector<Declaration> declarations_;
+  std::vector<Unit> units_;
+  std::vector<types::Type*> types_;
+
+  // Usages of declaration i are
+  //   occurrences_[occurrence_begin_[i] .. occurrence_begin_[i + 1]).
+  std::vector<uint32_t> occurrence_begin_;
+  std::vector<UsageId> occurrences_;
+
+  size_t live_usages_ = 0;
+};
+
+// Usages of the index as of the current text, with edits made since it
+//   was built (oldest first). Edits are applied to the positions a query
+//   reads, when it reads them: making an edit costs nothing, reading
+//   a position costs a step per edit. Usages and declarations the edits
+//   touch are dropped, the same as UsageIndex::ApplyEdit does.
+//
+// A view, doesn't own the index or the edits.
+class EditedUsages {
+public:
+  using UsageId = UsageIndex::UsageId;
+  using DeclarationId = UsageIndex::DeclarationId;
+
+  EditedUsages(const UsageIndex* index, const std::vector<PositionShift>* shifts)
+    : index_(index), shifts_(shifts) {}
+
+  std::optional<UsageId> Find(const lsPosition& position) const;
+
+  // Of a usage, which isn't dropped.
+  lsRange RangeOf(UsageId usage) const;
+
+  DeclarationId DeclarationOf(UsageId usage) const {
+    return index_->DeclarationOf(usage);
+  }
+
+  types::Type* TypeOf(UsageId usage) const {
+    return index_->TypeOf(usage);
+  }
+
+  lex::Location DeclPositionOf(DeclarationId declaration) const;
+
+  std::vector<UsageId> OccurrencesOf(DeclarationId declaration) const;
+
+private:
+  // Moves [first, last] along the edits. False, if one of them touches it.
+  bool Move(uint64_t* first, uint64_t* last) const;
+  bool Move(uint64_t* position) const;
+
+  bool IsUsageDropped(UsageId usage) const;
+  bool IsDeclarationDropped(DeclarationId declaration) const;
+
+  const UsageIndex* index_;
+  const std::vector<PositionShift>* shifts_;
+};